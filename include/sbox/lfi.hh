@@ -6,6 +6,7 @@
 #error "SBOX_STATIC cannot be used with the LFI backend"
 #endif
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
@@ -190,6 +191,7 @@ class Sandbox<LFI> {
 
     std::mutex symbol_cache_mutex_;
     std::unordered_map<std::string, lfiptr> symbol_cache_;
+    detail::SiteSymbolCache site_cache_;  // For SBOX_FN functions
 
     mutable std::thread::id main_thread_tid_;
 
@@ -227,7 +229,13 @@ public:
             (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
             "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
             "matching type");
-        return call<Ret(Params...)>(tn.name, args...);
+        using Sig = Ret(Params...);
+        void* fn = reinterpret_cast<void*>(lookup(tn));
+        if constexpr (std::is_void_v<Ret>) {
+            call_ptr_sig<Sig>(fn, args...);
+        } else {
+            return detail::wrap_sbox_return(call_ptr_sig<Sig>(fn, args...));
+        }
     }
 
     // Get a function handle for repeated calls
@@ -240,7 +248,7 @@ public:
     template<typename Ret, typename... Params>
     FnHandle<LFI, Ret(Params...)> fn(TypedName<Ret (*)(Params...)> tn) {
         return FnHandle<LFI, Ret(Params...)>(
-            *this, reinterpret_cast<void*>(lookup(tn.name)));
+            *this, reinterpret_cast<void*>(lookup(tn)));
     }
 
     // Call via function pointer (used by FnHandle)
@@ -408,6 +416,17 @@ public:
             &detail::callback_thunk_impl<decltype(fn), fn>::call);
     }
 
+    // Callbacks don't leave the process, so one-way ones are just callbacks
+    template<typename... Args>
+    sbox<void (*)(Args...)> register_oneway_callback(void (*fn)(Args...)) {
+        return register_callback(fn);
+    }
+
+    template<auto fn>
+    auto register_oneway_callback() {
+        return register_callback<fn>();
+    }
+
     // -- Stack allocation (used by CallContext) --
 
     void* stack_push(size_t size, size_t align = 16);
@@ -424,6 +443,11 @@ public:
 
     CallContext<LFI> context();
 
+    // Create a batch of function handle calls
+    CallBatch<LFI> batch() {
+        return CallBatch<LFI>(*this);
+    }
+
     LFIBox* native_handle() const { return box_; }
     LFILinuxProc* proc() const { return proc_; }
 
@@ -457,6 +481,16 @@ private:
 
     lfiptr lookup(const char* name);
 
+    // Resolve once per SBOX_FN function, without the name-keyed cache's lock and
+    // string key
+    template<typename FnPtr>
+    lfiptr lookup(TypedName<FnPtr> tn) {
+        return reinterpret_cast<lfiptr>(site_cache_.lookup(
+            tn.site, tn.name, [this](const char* name) {
+                return reinterpret_cast<void*>(lookup(name));
+            }));
+    }
+
     struct ThreadCtxEntry {
         LFIBox* box;
         LFIContext* ctx;
@@ -468,8 +502,13 @@ private:
 // LFI CallContext - uses sandbox stack for in/out/inout parameters
 template<>
 class CallContext<LFI> {
+    // Arrays larger than this are staged on the sandbox heap instead of its
+    // stack
+    static constexpr size_t kStackStageMax = 4096;
+
     Sandbox<LFI>* sandbox_;
-    std::vector<std::function<void()>> copybacks_;
+    detail::CopybackList copybacks_;
+    std::vector<void*> heap_;  // Heap-staged arrays, freed with the context
     uint64_t saved_sp_;
     bool finalized_ = false;
 
@@ -479,6 +518,8 @@ public:
 
     ~CallContext() {
         finalize();
+        for (void* p : heap_)
+            sandbox_->free(p);
         sandbox_->stack_restore(saved_sp_);
     }
 
@@ -489,17 +530,13 @@ public:
         if (finalized_)
             return;
         finalized_ = true;
-        for (auto& cb : copybacks_) {
-            cb();
-        }
+        copybacks_.run();
     }
 
     template<typename T>
     T* out(T& host_ref) {
         T* sbox_ptr = static_cast<T*>(sandbox_->stack_push(sizeof(T), alignof(T)));
-        T* host_ptr = &host_ref;
-        copybacks_.push_back(
-            [host_ptr, sbox_ptr]() { *host_ptr = *sbox_ptr; });
+        copybacks_.add(&host_ref, sbox_ptr);
         return sbox_ptr;
     }
 
@@ -513,10 +550,50 @@ public:
     template<typename T>
     T* inout(T& host_ref) {
         T* sbox_ptr = static_cast<T*>(sandbox_->stack_push(sizeof(T), alignof(T)));
-        T* host_ptr = &host_ref;
         *sbox_ptr = host_ref;
-        copybacks_.push_back(
-            [host_ptr, sbox_ptr]() { *host_ptr = *sbox_ptr; });
+        copybacks_.add(&host_ref, sbox_ptr);
+        return sbox_ptr;
+    }
+
+    // Array versions, for count elements starting at data
+    template<typename T>
+    T* out(T* data, size_t count) {
+        T* sbox_ptr = stage<T>(count);
+        copybacks_.add(data, sbox_ptr, count);
+        return sbox_ptr;
+    }
+
+    template<typename T>
+    const T* in(const T* data, size_t count) {
+        T* sbox_ptr = stage<T>(count);
+        std::copy_n(data, count, sbox_ptr);
+        return sbox_ptr;
+    }
+
+    template<typename T>
+    T* inout(T* data, size_t count) {
+        T* sbox_ptr = stage<T>(count);
+        std::copy_n(data, count, sbox_ptr);
+        copybacks_.add(data, sbox_ptr, count);
+        return sbox_ptr;
+    }
+
+    const char* in_string(const char* str) {
+        return in(str, std::strlen(str) + 1);
+    }
+
+private:
+    template<typename T>
+    T* stage(size_t count) {
+        size_t size = sizeof(T) * (count > 0 ? count : 1);
+        if (size <= kStackStageMax)
+            return static_cast<T*>(sandbox_->stack_push(size, alignof(T)));
+        T* sbox_ptr = sandbox_->template alloc<T>(count).data();
+        if (!sbox_ptr) {
+            fprintf(stderr, "sbox: failed to stage %zu bytes\n", size);
+            abort();
+        }
+        heap_.push_back(sbox_ptr);
         return sbox_ptr;
     }
 };
@@ -546,7 +623,14 @@ auto Sandbox<LFI>::call(CallContext<LFI>& ctx,
         (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
         "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
         "matching type");
-    return call<Ret(Params...)>(ctx, tn.name, args...);
+    if constexpr (std::is_void_v<Ret>) {
+        this->call(tn, args...);
+        ctx.finalize();
+    } else {
+        auto result = this->call(tn, args...);
+        ctx.finalize();
+        return result;
+    }
 }
 
 }  // namespace sbox
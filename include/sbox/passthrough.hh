@@ -84,6 +84,26 @@ public:
     T* inout(T& host_ref) {
         return &host_ref;
     }
+
+    // Arrays and strings are passed as they are
+    template<typename T>
+    T* out(T* data, size_t) {
+        return data;
+    }
+
+    template<typename T>
+    const T* in(const T* data, size_t) {
+        return data;
+    }
+
+    template<typename T>
+    T* inout(T* data, size_t) {
+        return data;
+    }
+
+    const char* in_string(const char* str) {
+        return str;
+    }
 };
 
 // Passthrough backend - loads library normally via dlopen, or static mode
@@ -116,20 +136,11 @@ public:
     // 'name' must be a string literal (pointer is cached directly).
     template<typename Sig, typename... Args>
     auto call(const char* name, Args... args) {
-        void* fn = lookup(name);
-        if (!fn) {
-            fprintf(stderr, "sbox: symbol not found: %s\n", name);
-            abort();
-        }
-        using Ret = detail::sig_return_t<Sig>;
-        if constexpr (std::is_void_v<Ret>) {
-            call_ptr_sig<Sig>(fn, args...);
-        } else {
-            return detail::wrap_sbox_return(call_ptr_sig<Sig>(fn, args...));
-        }
+        return call_sym<Sig>(lookup(name), name, args...);
     }
 
-    // Call with TypedName (dynamic mode, signature deduced from declaration)
+    // Call with TypedName (dynamic mode, signature deduced from declaration).
+    // The symbol is resolved once per function and sandbox.
     template<typename Ret, typename... Params, typename... Args>
     auto call(TypedName<Ret (*)(Params...)> tn, Args... args) {
         static_assert(sizeof...(Params) == sizeof...(Args),
@@ -138,7 +149,7 @@ public:
             (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
             "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
             "matching type");
-        return call<Ret(Params...)>(tn.name, args...);
+        return call_sym<Ret(Params...)>(lookup(tn), tn.name, args...);
     }
 
     // Call a function by pointer (static mode)
@@ -178,7 +189,14 @@ public:
             (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
             "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
             "matching type");
-        return call<Ret(Params...)>(ctx, tn.name, args...);
+        if constexpr (std::is_void_v<Ret>) {
+            call(tn, args...);
+            ctx.finalize();
+        } else {
+            auto result = call(tn, args...);
+            ctx.finalize();
+            return result;
+        }
     }
 
     // Context-aware call by pointer (static mode)
@@ -201,6 +219,11 @@ public:
         return CallContext<Passthrough>(*this);
     }
 
+    // Create a batch of function handle calls
+    CallBatch<Passthrough> batch() {
+        return CallBatch<Passthrough>(*this);
+    }
+
     // Get a function handle for repeated calls (dynamic mode).
     // 'name' must be a string literal (pointer is cached directly).
     template<typename Sig>
@@ -211,7 +234,7 @@ public:
     // Get a function handle with TypedName (signature deduced from declaration)
     template<typename Ret, typename... Params>
     FnHandle<Passthrough, Ret(Params...)> fn(TypedName<Ret (*)(Params...)> tn) {
-        return FnHandle<Passthrough, Ret(Params...)>(*this, lookup(tn.name));
+        return FnHandle<Passthrough, Ret(Params...)>(*this, lookup(tn));
     }
 
     // Get a function handle by pointer (static mode) - just returns the pointer
@@ -360,6 +383,17 @@ public:
         return sbox<Ret (*)(Args...)>(fn);
     }
 
+    // One-way callbacks are called directly too
+    template<typename... Args>
+    sbox<void (*)(Args...)> register_oneway_callback(void (*fn)(Args...)) {
+        return register_callback(fn);
+    }
+
+    template<auto fn>
+    auto register_oneway_callback() {
+        return register_callback<fn>();
+    }
+
     // Escape hatch for advanced usage (returns dlopen handle)
     void* native_handle() const {
         return handle_;
@@ -393,6 +427,29 @@ private:
         return call_ptr_sig(fn, static_cast<Sig*>(nullptr), args...);
     }
 
+    // Call a resolved symbol, aborting if it was not found
+    template<typename Sig, typename... Args>
+    auto call_sym(void* fn, const char* name, Args... args) {
+        if (!fn) {
+            fprintf(stderr, "sbox: symbol not found: %s\n", name);
+            abort();
+        }
+        using Ret = detail::sig_return_t<Sig>;
+        if constexpr (std::is_void_v<Ret>) {
+            call_ptr_sig<Sig>(fn, args...);
+        } else {
+            return detail::wrap_sbox_return(call_ptr_sig<Sig>(fn, args...));
+        }
+    }
+
+    template<typename FnPtr>
+    void* lookup(TypedName<FnPtr> tn) {
+        return site_cache_.lookup(tn.site, tn.name,
+                                  [this](const char* name) {
+                                      return lookup(name);
+                                  });
+    }
+
     void* lookup(const char* name) {
         std::lock_guard<std::mutex> lock(cache_mutex_);
 
@@ -411,6 +468,7 @@ private:
     void* handle_ = nullptr;
     std::unordered_map<const char*, void*> symbol_cache_;
     std::mutex cache_mutex_;
+    detail::SiteSymbolCache site_cache_;
 };
 
 }  // namespace sbox
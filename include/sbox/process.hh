@@ -7,10 +7,14 @@
 #endif
 
 #include <sys/types.h>
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <functional>
+#include <initializer_list>
+#include <memory>
 #include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <utility>
 #include <vector>
@@ -101,6 +105,15 @@ struct pbox_type<sbox<T*>> {
 template<typename T>
 inline constexpr PBoxType pbox_type_v = pbox_type<T>::value;
 
+// A signature's PBOX_TYPE_* description, built at compile time
+template<typename Ret, typename... Args>
+struct pbox_signature {
+    static constexpr PBoxType ret_type = pbox_type_v<Ret>;
+    static constexpr int nargs = sizeof...(Args);
+    static constexpr PBoxType arg_types[nargs > 0 ? nargs : 1] = {
+        pbox_type_v<Args>...};
+};
+
 // Read a typed argument from packed arg_storage at the given offset
 template<size_t I, typename T>
 T read_callback_arg(const char* arg_storage, const uint64_t* arg_offsets) {
@@ -133,6 +146,118 @@ void callback_dispatch(pbox_fn_t func_ptr, const char* arg_storage,
 
 }  // namespace detail
 
+// Pending result of an asynchronous call (see Sandbox<Process>::call_async).
+// Must be completed on the thread that started the call. If never waited
+// for, the destructor waits for the call to finish.
+template<typename Ret>
+class AsyncCall {
+    using Storage = std::conditional_t<std::is_void_v<Ret>, char, Ret>;
+
+    PBox* box_;
+    Sandbox<Process>* sandbox_;
+    pbox_token_t token_;
+    Storage value_{};
+    bool ok_ = false;
+
+public:
+    AsyncCall(PBox* box, Sandbox<Process>* sandbox, pbox_token_t token)
+        : box_(box), sandbox_(sandbox), token_(token) {}
+
+    ~AsyncCall() {
+        if (token_)
+            complete();
+    }
+
+    AsyncCall(AsyncCall&& other)
+        : box_(other.box_), sandbox_(other.sandbox_), token_(other.token_),
+          value_(other.value_), ok_(other.ok_) {
+        other.token_ = 0;
+    }
+
+    AsyncCall(const AsyncCall&) = delete;
+    AsyncCall& operator=(const AsyncCall&) = delete;
+    AsyncCall& operator=(AsyncCall&&) = delete;
+
+    // True once the call has finished (never blocks)
+    bool ready() {
+        if (!token_)
+            return true;
+        detail::tls_current_sandbox = sandbox_;
+        return pbox_poll(box_, token_) != 0;
+    }
+
+    // Block until the call has finished
+    void wait() {
+        if (token_)
+            complete();
+    }
+
+    // Wait for and return the result
+    auto get() {
+        wait();
+        if (!ok_)
+            throw std::runtime_error("async sandbox call failed");
+        if constexpr (!std::is_void_v<Ret>)
+            return detail::wrap_sbox_return(value_);
+    }
+
+private:
+    void complete() {
+        detail::tls_current_sandbox = sandbox_;
+        void* ret = std::is_void_v<Ret> ? nullptr : &value_;
+        ok_ = pbox_wait(box_, token_, ret) == 0;
+        token_ = 0;
+    }
+};
+
+// A small object passed by pointer inside the call message, so the call
+// needs no sandbox memory for it (see pbox_call_inline). Made with
+// inline_in, inline_out and inline_inout.
+template<typename T>
+struct InlineArg {
+    T* ptr;
+    int flags;  // PBOX_INLINE_*
+};
+
+// Pass a pointer to a copy of value
+template<typename T>
+InlineArg<T> inline_in(const T& value) {
+    return {const_cast<T*>(&value), PBOX_INLINE_IN};
+}
+
+// Pass a pointer to zeroed storage, copied to value when the call returns
+template<typename T>
+InlineArg<T> inline_out(T& value) {
+    return {&value, PBOX_INLINE_OUT};
+}
+
+// Pass a pointer to a copy of value, copied back when the call returns
+template<typename T>
+InlineArg<T> inline_inout(T& value) {
+    return {&value, PBOX_INLINE_IN | PBOX_INLINE_OUT};
+}
+
+namespace detail {
+
+template<typename T>
+struct is_inline_arg : std::false_type {};
+template<typename T>
+struct is_inline_arg<InlineArg<T>> : std::true_type {};
+template<typename T>
+inline constexpr bool is_inline_arg_v = is_inline_arg<T>::value;
+
+// Space an argument takes in the call message's inline area
+template<typename T>
+struct inline_span {
+    static constexpr size_t value = 0;
+};
+template<typename T>
+struct inline_span<InlineArg<T>> {
+    static constexpr size_t value = (sizeof(T) + 15) & ~size_t(15);
+};
+
+}  // namespace detail
+
 // Process backend - runs code in sandboxed child process via pbox
 template<>
 class Sandbox<Process> {
@@ -141,6 +266,25 @@ public:
         box_ = pbox_create(sandbox_executable);
     }
 
+    // Create a sandbox and resolve the given functions up front, in as few
+    // round trips as possible, so that calling them later needs no lookup.
+    // Names may be string literals or SBOX_FN(...) expressions.
+    Sandbox(const char* sandbox_executable,
+            std::initializer_list<const char*> preload_names)
+        : Sandbox(sandbox_executable) {
+        if (box_)
+            preload(preload_names.begin(), preload_names.size());
+    }
+
+    // Create a sandbox with creation options (see PBoxOptions), optionally
+    // preloading functions as above
+    Sandbox(const char* sandbox_executable, const PBoxOptions& options,
+            std::initializer_list<const char*> preload_names = {}) {
+        box_ = pbox_create_with_options(sandbox_executable, &options);
+        if (box_ && preload_names.size() > 0)
+            preload(preload_names.begin(), preload_names.size());
+    }
+
     ~Sandbox() {
         if (box_) {
             pbox_destroy(box_);
@@ -159,29 +303,52 @@ public:
     // 'name' must be a string literal (pointer is cached directly).
     template<typename Sig, typename... Args>
     auto call(const char* name, Args... args) {
+        return call_sym<Sig>(lookup(name), name, args...);
+    }
+
+    // Call with TypedName (signature deduced from declaration). The symbol
+    // is resolved once per function and sandbox.
+    template<typename Ret, typename... Params, typename... Args>
+    auto call(TypedName<Ret (*)(Params...)> tn, Args... args) {
+        static_assert(sizeof...(Params) == sizeof...(Args),
+                      "Wrong number of arguments for sandboxed function");
+        static_assert(
+            ((detail::check_sbox_ptr_arg_v<Params, Args> ||
+              detail::is_inline_arg_v<Args>) &&
+             ...),
+            "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
+            "matching type");
+        return call_sym<Ret(Params...)>(lookup(tn), tn.name, args...);
+    }
+
+    // Start a call by name without waiting for it. Returns an AsyncCall
+    // whose get() yields the result.
+    template<typename Sig, typename... Args>
+    auto call_async(const char* name, Args... args) {
         void* fn = lookup(name);
         if (!fn) {
             fprintf(stderr, "sbox: symbol not found: %s\n", name);
             abort();
         }
-        using Ret = detail::sig_return_t<Sig>;
-        if constexpr (std::is_void_v<Ret>) {
-            call_ptr_sig<Sig>(fn, args...);
-        } else {
-            return detail::wrap_sbox_return(call_ptr_sig<Sig>(fn, args...));
-        }
+        return call_async_sig(fn, static_cast<Sig*>(nullptr), args...);
     }
 
-    // Call with TypedName (signature deduced from declaration)
+    // Start a call with TypedName without waiting for it
     template<typename Ret, typename... Params, typename... Args>
-    auto call(TypedName<Ret (*)(Params...)> tn, Args... args) {
+    auto call_async(TypedName<Ret (*)(Params...)> tn, Args... args) {
         static_assert(sizeof...(Params) == sizeof...(Args),
                       "Wrong number of arguments for sandboxed function");
         static_assert(
             (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
             "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
             "matching type");
-        return call<Ret(Params...)>(tn.name, args...);
+        void* fn = lookup(tn);
+        if (!fn) {
+            fprintf(stderr, "sbox: symbol not found: %s\n", tn.name);
+            abort();
+        }
+        return call_async_sig(fn, static_cast<Ret (*)(Params...)>(nullptr),
+                              args...);
     }
 
     // Context-aware call (defined after CallContext)
@@ -196,6 +363,18 @@ public:
     // Create a call context (defined after CallContext)
     inline CallContext<Process> context();
 
+    // Create a batch of function handle calls (defined after CallBatch)
+    inline CallBatch<Process> batch();
+
+    // Resolve functions in bulk and add them to the symbol cache.
+    // Returns the number of functions found.
+    size_t preload(const char* const* names, size_t count) {
+        std::vector<void*> addrs(count);
+        size_t found = pbox_dlsym_many(box_, names, count, addrs.data());
+        add_symbols(names, addrs.data(), count);
+        return found;
+    }
+
     // Get a function handle for repeated calls.
     // 'name' must be a string literal (pointer is cached directly).
     template<typename Sig>
@@ -206,7 +385,7 @@ public:
     // Get a function handle with TypedName (signature deduced from declaration)
     template<typename Ret, typename... Params>
     FnHandle<Process, Ret(Params...)> fn(TypedName<Ret (*)(Params...)> tn) {
-        return FnHandle<Process, Ret(Params...)>(*this, lookup(tn.name));
+        return FnHandle<Process, Ret(Params...)>(*this, lookup(tn));
     }
 
     // Call via function pointer (used by FnHandle)
@@ -215,6 +394,60 @@ public:
         return call_impl<Ret, Args...>(fn, args...);
     }
 
+    // Describe a signature to the sandbox for call_ptr_desc (used by
+    // FnHandle). Returns -1 if it could not be described.
+    template<typename Ret, typename... Args>
+    int describe() {
+        using Sig = detail::pbox_signature<Ret, Args...>;
+        static_assert(Sig::nargs <= PBOX_MAX_ARGS,
+                      "Too many arguments (max is PBOX_MAX_ARGS)");
+        return pbox_describe_call(box_, Sig::ret_type, Sig::nargs,
+                                  Sig::arg_types);
+    }
+
+    // Call via function pointer with a described signature: the arguments
+    // are packed into one block and sent with the descriptor (used by
+    // FnHandle). Falls back to call_ptr if desc is -1.
+    template<typename Ret, typename... Args>
+    Ret call_ptr_desc(int desc, void* fn, Args... args) {
+        if (desc < 0)
+            return call_impl<Ret, Args...>(fn, args...);
+
+        detail::tls_current_sandbox = this;
+        uint64_t packed[sizeof...(Args) > 0 ? sizeof...(Args) : 1] = {};
+        [[maybe_unused]] int i = 0;
+        (std::memcpy(&packed[i++], &args, sizeof(Args)), ...);
+
+        if constexpr (std::is_void_v<Ret>) {
+            pbox_call_desc(box_, desc, fn, packed, nullptr);
+        } else {
+            Ret result;
+            pbox_call_desc(box_, desc, fn, packed, &result);
+            return result;
+        }
+    }
+
+    // Start a call via function pointer (used by FnHandle::async)
+    template<typename Ret, typename... Args>
+    AsyncCall<Ret> call_ptr_async(void* fn, Args... args) {
+        constexpr int nargs = sizeof...(Args);
+        static_assert(nargs <= PBOX_MAX_ARGS,
+                      "Too many arguments (max is PBOX_MAX_ARGS)");
+
+        PBoxType arg_types[nargs > 0 ? nargs : 1];
+        void* arg_ptrs[nargs > 0 ? nargs : 1];
+
+        if constexpr (nargs > 0) {
+            fill_arg_types<0, Args...>(arg_types);
+            fill_arg_ptrs<0>(arg_ptrs, args...);
+        }
+
+        pbox_token_t token = pbox_call_async(
+            box_, fn, detail::pbox_type_v<Ret>, nargs,
+            nargs > 0 ? arg_types : nullptr, nargs > 0 ? arg_ptrs : nullptr);
+        return AsyncCall<Ret>(box_, this, token);
+    }
+
     // Memory allocation in sandbox. Returns sbox<T*> (unchecked) since the
     // pointer is in the sandbox's address space (not directly dereferenceable).
     template<typename T>
@@ -291,11 +524,32 @@ public:
         pbox_idmem_reset(box_);
     }
 
+    // Identity-mapped memory that outlives idmem_reset (per-thread)
+    template<typename T>
+    T* idmem_malloc(size_t count = 1) {
+        return static_cast<T*>(pbox_idmem_malloc(box_, sizeof(T) * count));
+    }
+
+    void idmem_free(void* ptr) {
+        pbox_idmem_free(box_, ptr);
+    }
+
+    PBoxIdmemStats idmem_stats() {
+        PBoxIdmemStats stats;
+        pbox_idmem_stats(box_, &stats);
+        return stats;
+    }
+
     // File descriptor registration (sends fd to sandbox)
     int register_fd(int fd) {
         return pbox_send_fd(box_, fd);
     }
 
+    // Register several fds in one exchange. Returns false if any failed.
+    bool register_fds(const int* fds, size_t count, int* sandbox_fds) {
+        return pbox_send_fds(box_, fds, count, sandbox_fds) == 0;
+    }
+
     // Close a file descriptor in sandbox
     int close_fd(int sandbox_fd) {
         return pbox_close(box_, sandbox_fd);
@@ -328,6 +582,15 @@ public:
         copy_from(d, sbox<T*>(s), n);
     }
 
+    // Vectored data transfer (one pass for all regions)
+    void copy_to_v(const PBoxCopyRegion* regions, size_t count) {
+        pbox_copy_to_v(box_, regions, count);
+    }
+
+    void copy_from_v(const PBoxCopyRegion* regions, size_t count) {
+        pbox_copy_from_v(box_, regions, count);
+    }
+
     // String helper
     sbox<char*> copy_string(const char* s) {
         size_t len = std::strlen(s) + 1;
@@ -363,6 +626,31 @@ public:
             &detail::callback_thunk_impl<decltype(fn), fn>::call);
     }
 
+    // Register a one-way callback: the sandbox queues each call instead of
+    // waiting for it, and the queue runs on the calling host thread by the
+    // time the enclosing call returns
+    template<typename... Args>
+    sbox<void (*)(Args...)> register_oneway_callback(void (*fn)(Args...)) {
+        constexpr int nargs = sizeof...(Args);
+        static_assert(nargs <= PBOX_MAX_ARGS,
+                      "Too many callback arguments (max is PBOX_MAX_ARGS)");
+        PBoxType arg_types[nargs > 0 ? nargs : 1];
+        if constexpr (nargs > 0) {
+            fill_arg_types<0, Args...>(arg_types);
+        }
+        void* raw = pbox_register_oneway_callback(
+            box_, reinterpret_cast<pbox_fn_t>(fn),
+            detail::callback_dispatch<void, Args...>, nargs,
+            nargs > 0 ? arg_types : nullptr);
+        return sbox<void (*)(Args...)>(reinterpret_cast<void (*)(Args...)>(raw));
+    }
+
+    template<auto fn>
+    auto register_oneway_callback() {
+        return register_oneway_callback(
+            &detail::callback_thunk_impl<decltype(fn), fn>::call);
+    }
+
     // Process-specific
     pid_t pid() const {
         return pbox_pid(box_);
@@ -371,15 +659,60 @@ public:
         return pbox_alive(box_);
     }
 
+    // Spin/futex wait policy for this sandbox's channels
+    void set_wait_policy(const PBoxWaitPolicy& policy) {
+        pbox_set_wait_policy(box_, &policy);
+    }
+    PBoxWaitPolicy wait_policy() const {
+        return pbox_get_wait_policy(box_);
+    }
+
+    // Busy-poll the channels for up to idle_ns, with the workers on the
+    // given CPUs (see pbox_set_busy_poll). 0 turns it back off.
+    bool set_busy_poll(uint32_t idle_ns, const std::vector<int>& cpus = {}) {
+        return pbox_set_busy_poll(box_, idle_ns, cpus.data(), cpus.size()) ==
+               0;
+    }
+
+    // Placement of the calling thread's worker (see pbox_pin_worker)
+    bool pin_worker(int cpu = PBOX_CPU_SIBLING) {
+        return pbox_pin_worker(box_, cpu) == 0;
+    }
+    bool set_worker_sched(int policy, int priority = 0) {
+        return pbox_set_worker_sched(box_, policy, priority) == 0;
+    }
+
     // Escape hatch for advanced usage (returns pbox handle)
     PBox* native_handle() const {
         return box_;
     }
 
 private:
+    friend class SandboxPool<Process>;
+
+    // Adopt a sandbox created elsewhere (by SandboxPool)
+    explicit Sandbox(PBox* box) : box_(box) {}
+
+    // Add resolved functions to the symbol cache (NULL addresses are skipped)
+    void add_symbols(const char* const* names, void* const* addrs,
+                     size_t count) {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        for (size_t i = 0; i < count; i++) {
+            if (addrs[i]) {
+                symbol_cache_[names[i]] = addrs[i];
+                preloaded_[names[i]] = addrs[i];
+            }
+        }
+    }
+
     template<typename Ret, typename... Params, typename... Args>
     Ret call_ptr_sig(void* fn, Ret (*)(Params...), Args... args) {
-        return call_impl<Ret, Params...>(fn, convert_arg<Params>(args)...);
+        if constexpr ((detail::is_inline_arg_v<Args> || ...)) {
+            return call_inline_impl<Ret, Params...>(fn, args...);
+        } else {
+            return call_impl<Ret, Params...>(fn,
+                                             convert_arg<Params>(args)...);
+        }
     }
 
     template<typename Sig, typename... Args>
@@ -387,6 +720,13 @@ private:
         return call_ptr_sig(fn, static_cast<Sig*>(nullptr), args...);
     }
 
+    template<typename Ret, typename... Params, typename... Args>
+    AsyncCall<Ret> call_async_sig(void* fn, Ret (*)(Params...),
+                                  Args... args) {
+        return call_ptr_async<Ret, Params...>(fn,
+                                              convert_arg<Params>(args)...);
+    }
+
     // Convert argument, unwrapping sbox types
     template<typename To, typename From>
     static To convert_arg(From arg) {
@@ -430,6 +770,65 @@ private:
         }
     }
 
+    // pbox_call_inline implementation, for calls with InlineArg arguments
+    template<typename Ret, typename... Params, typename... Args>
+    Ret call_inline_impl(void* fn, Args... args) {
+        detail::tls_current_sandbox = this;
+        constexpr int nargs = sizeof...(Params);
+        static_assert(sizeof...(Args) == nargs,
+                      "Wrong number of arguments for sandboxed function");
+        static_assert(nargs <= PBOX_MAX_ARGS,
+                      "Too many arguments (max is PBOX_MAX_ARGS)");
+        static_assert((detail::inline_span<Args>::value + ...) <=
+                          PBOX_INLINE_MAX,
+                      "Inline arguments do not fit in the call message");
+
+        PBoxType arg_types[nargs];
+        uint64_t values[nargs] = {};
+        void* arg_ptrs[nargs];
+        PBoxInlineArg inl[nargs];
+        int ninline = 0;
+
+        fill_arg_types<0, Params...>(arg_types);
+        int i = 0;
+        (stage_arg<Params>(args, i++, values, inl, ninline), ...);
+        for (int j = 0; j < nargs; j++)
+            arg_ptrs[j] = &values[j];
+
+        if constexpr (std::is_void_v<Ret>) {
+            pbox_call_inline(box_, fn, PBOX_TYPE_VOID, nargs, arg_types,
+                             arg_ptrs, inl, ninline, nullptr);
+        } else {
+            Ret result;
+            pbox_call_inline(box_, fn, detail::pbox_type_v<Ret>, nargs,
+                             arg_types, arg_ptrs, inl, ninline, &result);
+            return result;
+        }
+    }
+
+    // Store one argument of an inline call: either its value, or its
+    // buffer for the call message
+    template<typename Param, typename Arg>
+    static void stage_arg(Arg arg, int i, uint64_t* values,
+                          PBoxInlineArg* inl, int& ninline) {
+        if constexpr (detail::is_inline_arg_v<Arg>) {
+            static_assert(std::is_pointer_v<Param>,
+                          "Inline arguments must be passed as pointers");
+            // An array buffer is passed as a pointer to its first element
+            static_assert(
+                std::is_same_v<
+                    std::remove_cv_t<std::remove_pointer_t<Param>>,
+                    std::remove_cv_t<std::remove_extent_t<
+                        std::remove_pointer_t<decltype(arg.ptr)>>>>,
+                "Inline argument type does not match the parameter");
+            inl[ninline++] = {i, static_cast<void*>(arg.ptr),
+                              sizeof(*arg.ptr), arg.flags};
+        } else {
+            Param value = convert_arg<Param>(arg);
+            std::memcpy(&values[i], &value, sizeof(Param));
+        }
+    }
+
     // Fill argument type array
     template<size_t I, typename T, typename... Rest>
     void fill_arg_types(PBoxType* types) {
@@ -452,6 +851,29 @@ private:
         }
     }
 
+    // Call a resolved symbol, aborting if it was not found
+    template<typename Sig, typename... Args>
+    auto call_sym(void* fn, const char* name, Args... args) {
+        if (!fn) {
+            fprintf(stderr, "sbox: symbol not found: %s\n", name);
+            abort();
+        }
+        using Ret = detail::sig_return_t<Sig>;
+        if constexpr (std::is_void_v<Ret>) {
+            call_ptr_sig<Sig>(fn, args...);
+        } else {
+            return detail::wrap_sbox_return(call_ptr_sig<Sig>(fn, args...));
+        }
+    }
+
+    template<typename FnPtr>
+    void* lookup(TypedName<FnPtr> tn) {
+        return site_cache_.lookup(tn.site, tn.name,
+                                  [this](const char* name) {
+                                      return lookup(name);
+                                  });
+    }
+
     void* lookup(const char* name) {
         std::lock_guard<std::mutex> lock(cache_mutex_);
 
@@ -460,7 +882,13 @@ private:
             return it->second;
         }
 
-        void* sym = pbox_dlsym(box_, name);
+        // The same name may have been preloaded through another pointer
+        void* sym = nullptr;
+        auto pre = preloaded_.find(name);
+        if (pre != preloaded_.end())
+            sym = pre->second;
+        else
+            sym = pbox_dlsym(box_, name);
         if (sym) {
             symbol_cache_[name] = sym;
         }
@@ -469,14 +897,133 @@ private:
 
     PBox* box_ = nullptr;
     std::unordered_map<const char*, void*> symbol_cache_;
+    std::unordered_map<std::string, void*> preloaded_;  // By name
     std::mutex cache_mutex_;
+    detail::SiteSymbolCache site_cache_;
+};
+
+// Process FnHandle - describes its signature to the sandbox once, so that
+// each call only sends the packed arguments and a descriptor
+template<typename Ret, typename... Args>
+class FnHandle<Process, Ret(Args...)> {
+public:
+    FnHandle(Sandbox<Process>& sandbox, void* fn_ptr)
+        : sandbox_(&sandbox), fn_ptr_(fn_ptr),
+          desc_(fn_ptr ? sandbox.template describe<Ret, Args...>() : -1) {}
+
+    template<typename... CallArgs>
+    auto operator()(CallArgs... args) const {
+        if constexpr (std::is_void_v<Ret>) {
+            sandbox_->template call_ptr_desc<Ret, Args...>(
+                desc_, fn_ptr_, detail::convert_call_arg<Args>(args)...);
+        } else {
+            return detail::wrap_sbox_return(
+                sandbox_->template call_ptr_desc<Ret, Args...>(
+                    desc_, fn_ptr_, detail::convert_call_arg<Args>(args)...));
+        }
+    }
+
+    // Start the call without waiting for it
+    template<typename... CallArgs>
+    auto async(CallArgs... args) const {
+        return sandbox_->template call_ptr_async<Ret, Args...>(
+            fn_ptr_, detail::convert_call_arg<Args>(args)...);
+    }
+
+private:
+    template<typename B>
+    friend class CallBatch;
+
+    Sandbox<Process>* sandbox_;
+    void* fn_ptr_;
+    int desc_;  // -1 if the signature could not be described
+};
+
+// Pool of ready-to-use process sandboxes (see pbox_pool_create). acquire()
+// hands out a sandbox that was created, and had the preload functions
+// resolved, in the background. When the returned handle is dropped the
+// sandbox is destroyed in the background too, and replaced. Handles must
+// not outlive the pool.
+template<>
+class SandboxPool<Process> {
+    struct Retire {
+        SandboxPool* pool;
+        void operator()(Sandbox<Process>* sandbox) const {
+            pool->retire(sandbox);
+        }
+    };
+
+public:
+    using Handle = std::unique_ptr<Sandbox<Process>, Retire>;
+
+    // Keep `size` sandboxes of the given executable ready. Names may be
+    // string literals or SBOX_FN(...) expressions.
+    SandboxPool(const char* sandbox_executable, size_t size,
+                std::initializer_list<const char*> preload_names = {})
+        : names_(preload_names) {
+        pool_ = pbox_pool_create(sandbox_executable, size, nullptr,
+                                 names_.data(), names_.size());
+    }
+
+    // As above, creating each sandbox with the given options
+    SandboxPool(const char* sandbox_executable, size_t size,
+                const PBoxOptions& options,
+                std::initializer_list<const char*> preload_names = {})
+        : names_(preload_names) {
+        pool_ = pbox_pool_create(sandbox_executable, size, &options,
+                                 names_.data(), names_.size());
+    }
+
+    ~SandboxPool() {
+        if (pool_)
+            pbox_pool_destroy(pool_);
+    }
+
+    // Non-copyable
+    SandboxPool(const SandboxPool&) = delete;
+    SandboxPool& operator=(const SandboxPool&) = delete;
+
+    // Take a sandbox, creating one on the spot if none is ready.
+    // Returns an empty handle if the sandbox could not be created.
+    Handle acquire() {
+        if (!pool_)
+            return Handle(nullptr, Retire{this});
+        std::vector<void*> addrs(names_.size());
+        PBox* box = pbox_pool_acquire(pool_, addrs.data());
+        if (!box)
+            return Handle(nullptr, Retire{this});
+        auto* sandbox = new Sandbox<Process>(box);
+        sandbox->add_symbols(names_.data(), addrs.data(), names_.size());
+        return Handle(sandbox, Retire{this});
+    }
+
+    // Number of sandboxes ready to be acquired
+    size_t ready() const {
+        return pool_ ? pbox_pool_ready(pool_) : 0;
+    }
+
+    // Escape hatch for advanced usage (returns pbox pool handle)
+    PBoxPool* native_handle() const {
+        return pool_;
+    }
+
+private:
+    void retire(Sandbox<Process>* sandbox) {
+        PBox* box = sandbox->box_;
+        sandbox->box_ = nullptr;
+        delete sandbox;
+        pbox_pool_retire(pool_, box);
+    }
+
+    PBoxPool* pool_ = nullptr;
+    std::vector<const char*> names_;
 };
 
 // Process CallContext - uses identity-mapped arena
 template<>
 class CallContext<Process> {
     Sandbox<Process>* sandbox_;
-    std::vector<std::function<void()>> copybacks_;
+    detail::CopybackList copybacks_;
     bool finalized_ = false;
 
 public:
@@ -496,9 +1043,7 @@ public:
         if (finalized_)
             return;
         finalized_ = true;
-        for (auto& cb : copybacks_) {
-            cb();
-        }
+        copybacks_.run();
     }
 
     // Out: allocate from idmem, register copy-back
@@ -507,9 +1052,7 @@ public:
         T* idmem_ptr = sandbox_->template idmem_alloc<T>();
         if (!idmem_ptr)
             throw std::runtime_error("idmem_alloc failed");
-        T* host_ptr = &host_ref;
-        copybacks_.push_back(
-            [host_ptr, idmem_ptr]() { *host_ptr = *idmem_ptr; });
+        copybacks_.add(&host_ref, idmem_ptr);
         return idmem_ptr;
     }
 
@@ -529,12 +1072,161 @@ public:
         T* idmem_ptr = sandbox_->template idmem_alloc<T>();
         if (!idmem_ptr)
             throw std::runtime_error("idmem_alloc failed");
-        T* host_ptr = &host_ref;
         *idmem_ptr = host_ref;
-        copybacks_.push_back(
-            [host_ptr, idmem_ptr]() { *host_ptr = *idmem_ptr; });
+        copybacks_.add(&host_ref, idmem_ptr);
         return idmem_ptr;
     }
+
+    // Array versions of the above, for count elements starting at data.
+    // Each stages the whole array in idmem, so passing a buffer costs no
+    // round trips beyond the call itself.
+    template<typename T>
+    T* out(T* data, size_t count) {
+        T* idmem_ptr = alloc_array<T>(count);
+        copybacks_.add(data, idmem_ptr, count);
+        return idmem_ptr;
+    }
+
+    template<typename T>
+    const T* in(const T* data, size_t count) {
+        T* idmem_ptr = alloc_array<T>(count);
+        std::copy_n(data, count, idmem_ptr);
+        return idmem_ptr;
+    }
+
+    template<typename T>
+    T* inout(T* data, size_t count) {
+        T* idmem_ptr = alloc_array<T>(count);
+        std::copy_n(data, count, idmem_ptr);
+        copybacks_.add(data, idmem_ptr, count);
+        return idmem_ptr;
+    }
+
+    // In: copy a NUL-terminated string
+    const char* in_string(const char* str) {
+        return in(str, std::strlen(str) + 1);
+    }
+
+private:
+    template<typename T>
+    T* alloc_array(size_t count) {
+        T* idmem_ptr =
+            sandbox_->template idmem_alloc<T>(count > 0 ? count : 1);
+        if (!idmem_ptr)
+            throw std::runtime_error("idmem_alloc failed");
+        return idmem_ptr;
+    }
+};
+
+// Process CallBatch - queues calls in the channel's call ring and runs them
+// with a single round trip to the sandbox
+template<>
+class CallBatch<Process> {
+    struct Entry {
+        void* fn;
+        PBoxType ret_type;
+        int nargs;
+        PBoxType arg_types[PBOX_MAX_ARGS];
+        uint64_t arg_values[PBOX_MAX_ARGS];
+        uint64_t result;
+    };
+
+    // Stores an entry's result through out once the batch has run
+    struct Copyback {
+        void* out;
+        size_t index;
+        void (*store)(void* out, const uint64_t* result);
+    };
+
+    Sandbox<Process>* sandbox_;
+    std::vector<Entry> entries_;
+    std::vector<Copyback> copybacks_;
+    // Kept across runs so that running a batch doesn't allocate
+    std::vector<PBoxBatchCall> calls_;
+    std::vector<void*> arg_ptrs_;
+
+    template<typename Out, typename Ret>
+    static void store_result(void* out, const uint64_t* result) {
+        Ret value;
+        std::memcpy(&value, result, sizeof(Ret));
+        *static_cast<Out*>(out) = detail::wrap_sbox_return(value);
+    }
+
+public:
+    explicit CallBatch(Sandbox<Process>& sb) : sandbox_(&sb) {
+    }
+
+    CallBatch(const CallBatch&) = delete;
+    CallBatch& operator=(const CallBatch&) = delete;
+
+    // Queue a call, discarding its result
+    template<typename Ret, typename... Args, typename... CallArgs>
+    void add(FnHandle<Process, Ret(Args...)> fn, CallArgs... args) {
+        push<Ret, Args...>(fn.fn_ptr_,
+                           detail::convert_call_arg<Args>(args)...);
+    }
+
+    // Queue a call whose result is stored in *out when the batch runs
+    template<typename Out, typename Ret, typename... Args,
+             typename... CallArgs>
+    void add(Out* out, FnHandle<Process, Ret(Args...)> fn, CallArgs... args) {
+        static_assert(!std::is_void_v<Ret>,
+                      "Cannot store the result of a void function");
+        size_t index = entries_.size();
+        push<Ret, Args...>(fn.fn_ptr_,
+                           detail::convert_call_arg<Args>(args)...);
+        copybacks_.push_back({out, index, &store_result<Out, Ret>});
+    }
+
+    size_t size() const {
+        return entries_.size();
+    }
+
+    // Run all queued calls in order. The batch is empty afterwards.
+    void run() {
+        calls_.resize(entries_.size());
+        arg_ptrs_.resize(entries_.size() * PBOX_MAX_ARGS);
+        for (size_t i = 0; i < entries_.size(); i++) {
+            Entry& e = entries_[i];
+            void** ptrs = &arg_ptrs_[i * PBOX_MAX_ARGS];
+            for (int j = 0; j < e.nargs; j++) {
+                ptrs[j] = &e.arg_values[j];
+            }
+            calls_[i] = {e.fn, e.ret_type, e.nargs, e.arg_types, ptrs,
+                         &e.result};
+        }
+
+        detail::tls_current_sandbox = sandbox_;
+        int rc = pbox_call_batch(sandbox_->native_handle(), calls_.data(),
+                                 static_cast<int>(calls_.size()));
+        if (rc == 0) {
+            for (const Copyback& cb : copybacks_) {
+                cb.store(cb.out, &entries_[cb.index].result);
+            }
+        }
+        entries_.clear();
+        copybacks_.clear();
+        if (rc != 0)
+            throw std::runtime_error("batched sandbox call failed");
+    }
+
+private:
+    template<typename Ret, typename... Args>
+    void push(void* fn, Args... args) {
+        constexpr int nargs = sizeof...(Args);
+        static_assert(nargs <= PBOX_MAX_ARGS,
+                      "Too many arguments (max is PBOX_MAX_ARGS)");
+
+        Entry e{};
+        e.fn = fn;
+        e.ret_type = detail::pbox_type_v<Ret>;
+        e.nargs = nargs;
+        [[maybe_unused]] int i = 0;
+        ((e.arg_types[i] = detail::pbox_type_v<Args>,
+          std::memcpy(&e.arg_values[i], &args, sizeof(Args)), i++),
+         ...);
+        entries_.push_back(e);
+    }
 };
 
 // Deferred method definitions (need CallContext to be complete)
@@ -542,6 +1234,10 @@ inline CallContext<Process> Sandbox<Process>::context() {
     return CallContext<Process>(*this);
 }
 
+inline CallBatch<Process> Sandbox<Process>::batch() {
+    return CallBatch<Process>(*this);
+}
+
 template<typename Sig, typename... Args>
 auto Sandbox<Process>::call(CallContext<Process>& ctx, const char* name,
                             Args... args) {
@@ -565,7 +1261,14 @@ auto Sandbox<Process>::call(CallContext<Process>& ctx,
         (detail::check_sbox_ptr_arg_v<Params, Args> && ...),
         "Pointer arguments must be sbox<T*> or sbox_safe<T*> with a "
         "matching type");
-    return call<Ret(Params...)>(ctx, tn.name, args...);
+    if constexpr (std::is_void_v<Ret>) {
+        this->call(tn, args...);
+        ctx.finalize();
+    } else {
+        auto result = this->call(tn, args...);
+        ctx.finalize();
+        return result;
+    }
 }
 
 }  // namespace sbox
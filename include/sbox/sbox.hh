@@ -1,10 +1,15 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <cstring>
+#include <functional>
 #include <mutex>
 #include <type_traits>
 #include <unordered_map>
+#include <vector>
 
 namespace sbox {
 
@@ -192,6 +197,141 @@ struct callback_thunk_impl<Ret (*)(Args...), fn> {
 // thunks can inject the sandbox reference into user callbacks.
 inline thread_local void* tls_current_sandbox = nullptr;
 
+// Cache key of a function named with SBOX_FN (see site_for), numbered on
+// first use, which indexes the per-sandbox SiteSymbolCache.
+struct SymbolSite {
+    std::atomic<uint32_t> id{0};  // 0 until numbered
+
+    uint32_t get() {
+        uint32_t cur = id.load(std::memory_order_acquire);
+        if (cur)
+            return cur;
+        static std::atomic<uint32_t> next_id{0};
+        uint32_t fresh = next_id.fetch_add(1, std::memory_order_relaxed) + 1;
+        if (id.compare_exchange_strong(cur, fresh, std::memory_order_acq_rel))
+            return fresh;
+        return cur;  // Numbered by another thread
+    }
+};
+
+// Symbols resolved per function named with SBOX_FN. Lookups are a couple of atomic loads:
+// slots live in fixed pages that are allocated on first use and never move.
+class SiteSymbolCache {
+    static constexpr uint32_t kPageBits = 8;
+    static constexpr uint32_t kPageSlots = 1u << kPageBits;
+    static constexpr uint32_t kMaxPages = 1024;  // Sites past this go uncached
+
+    std::atomic<std::atomic<void*>*> pages_[kMaxPages] = {};
+
+public:
+    SiteSymbolCache() = default;
+    SiteSymbolCache(const SiteSymbolCache&) = delete;
+    SiteSymbolCache& operator=(const SiteSymbolCache&) = delete;
+
+    ~SiteSymbolCache() {
+        for (auto& page : pages_)
+            delete[] page.load(std::memory_order_relaxed);
+    }
+
+    // Returns nullptr if the site has not been resolved
+    void* get(uint32_t id) const {
+        uint32_t p = id >> kPageBits;
+        if (p >= kMaxPages)
+            return nullptr;
+        std::atomic<void*>* page = pages_[p].load(std::memory_order_acquire);
+        if (!page)
+            return nullptr;
+        return page[id & (kPageSlots - 1)].load(std::memory_order_acquire);
+    }
+
+    void set(uint32_t id, void* sym) {
+        uint32_t p = id >> kPageBits;
+        if (p >= kMaxPages)
+            return;
+        std::atomic<void*>* page = pages_[p].load(std::memory_order_acquire);
+        if (!page) {
+            auto* fresh = new std::atomic<void*>[kPageSlots]();
+            if (pages_[p].compare_exchange_strong(page, fresh,
+                                                  std::memory_order_acq_rel))
+                page = fresh;
+            else
+                delete[] fresh;  // page now holds the winner's
+        }
+        page[id & (kPageSlots - 1)].store(sym, std::memory_order_release);
+    }
+
+    // Resolve a site, calling resolve(name) only on the first use per
+    // sandbox. Unresolved symbols are not cached.
+    template<typename Resolve>
+    void* lookup(SymbolSite* site, const char* name, Resolve&& resolve) {
+        if (!site)
+            return resolve(name);
+        uint32_t id = site->get();
+        if (void* sym = get(id))
+            return sym;
+        void* sym = resolve(name);
+        if (sym)
+            set(id, sym);
+        return sym;
+    }
+};
+
+// The cache key SBOX_FN uses for a function: one per function, shared by
+// every SBOX_FN naming it, not one per call site. Naming the function as a
+// template argument odr-uses it, so the host needs its declaration and,
+// formally, a definition. GCC and Clang only encode the name in the
+// variable's mangled symbol and emit no reference to the function, so a
+// library linked only into the sandbox works in practice.
+template<auto Fn>
+inline SymbolSite site_for{};
+
+// Copy-backs registered by a CallContext, run once the call returns. Each is
+// a pair of pointers, an element count and a copy function instantiated for
+// its type, and the first kInline live in the list itself, so a context with
+// a handful of out-params never allocates.
+class CopybackList {
+    struct Entry {
+        void* host;
+        const void* sbox;
+        size_t count;
+        void (*copy)(void* host, const void* sbox, size_t count);
+    };
+
+    static constexpr size_t kInline = 16;
+
+    Entry inline_[kInline];
+    size_t count_ = 0;
+    std::vector<Entry> overflow_;  // Entries past kInline
+
+    template<typename T>
+    static void copy_elems(void* host, const void* sbox, size_t count) {
+        std::copy_n(static_cast<const T*>(sbox), count,
+                    static_cast<T*>(host));
+    }
+
+public:
+    CopybackList() = default;
+    CopybackList(const CopybackList&) = delete;
+    CopybackList& operator=(const CopybackList&) = delete;
+
+    template<typename T>
+    void add(T* host, const T* sbox, size_t count = 1) {
+        Entry e{host, sbox, count, &copy_elems<T>};
+        if (count_ < kInline)
+            inline_[count_++] = e;
+        else
+            overflow_.push_back(e);
+    }
+
+    void run() const {
+        for (size_t i = 0; i < count_; i++)
+            inline_[i].copy(inline_[i].host, inline_[i].sbox,
+                            inline_[i].count);
+        for (const Entry& e : overflow_)
+            e.copy(e.host, e.sbox, e.count);
+    }
+};
+
 }  // namespace detail
 
 // TypedName - carries a function's name string along with its declared type.
@@ -200,6 +340,8 @@ inline thread_local void* tls_current_sandbox = nullptr;
 template<typename FnPtr>
 struct TypedName {
     const char* name;
+    // Symbol cache key (null if not created by SBOX_FN)
+    detail::SymbolSite* site = nullptr;
     // Implicit conversion to const char* for backward compatibility
     // with call<Sig>(const char*, ...) overloads.
     operator const char*() const { return name; }
@@ -209,11 +351,14 @@ struct TypedName {
 
 // Macro to reference a function - expands differently based on backend.
 // In static mode: expands to function pointer (direct call, type-safe).
-// In dynamic mode: expands to TypedName carrying name + type from declaration.
+// In dynamic mode: expands to TypedName carrying name + type from declaration,
+// plus the function's symbol cache key. It stays a constant expression.
 #ifdef SBOX_STATIC
 #define SBOX_FN(name) (name)
 #else
-#define SBOX_FN(name) (sbox::TypedName<decltype(&name)>{#name})
+#define SBOX_FN(name)                               \
+    (sbox::TypedName<decltype(&name)>{              \
+        #name, &sbox::detail::site_for<&name>})
 #endif
 
 namespace sbox {
@@ -230,6 +375,12 @@ class Sandbox;
 template<typename Backend>
 class CallContext;
 
+template<typename Backend>
+class CallBatch;
+
+template<typename Backend>
+class SandboxPool;
+
 // Specialization for callbacks whose first parameter is Sandbox<Backend>&.
 // The thunk strips the sandbox parameter from the C-visible signature and
 // injects it from thread-local storage at call time.
@@ -272,9 +423,61 @@ public:
         }
     }
 
+    // Start the call without waiting for it (backends with async support)
+    template<typename... CallArgs>
+    auto async(CallArgs... args) const {
+        return sandbox_->template call_ptr_async<Ret, Args...>(
+            fn_ptr_, detail::convert_call_arg<Args>(args)...);
+    }
+
 private:
+    template<typename B>
+    friend class CallBatch;
+
     Sandbox<Backend>* sandbox_;
     void* fn_ptr_;
 };
 
+// Batch of function handle calls that run together when run() is called,
+// storing results in host variables. Backends that can enter the sandbox
+// once for the whole batch specialize this; by default the calls are simply
+// made one after another.
+template<typename Backend>
+class CallBatch {
+    std::vector<std::function<void()>> calls_;
+
+public:
+    explicit CallBatch(Sandbox<Backend>&) {}
+
+    CallBatch(const CallBatch&) = delete;
+    CallBatch& operator=(const CallBatch&) = delete;
+
+    // Queue a call, discarding its result
+    template<typename Ret, typename... Args, typename... CallArgs>
+    void add(FnHandle<Backend, Ret(Args...)> fn, CallArgs... args) {
+        calls_.push_back([fn, args...]() { fn(args...); });
+    }
+
+    // Queue a call whose result is stored in *out when the batch runs
+    template<typename Out, typename Ret, typename... Args,
+             typename... CallArgs>
+    void add(Out* out, FnHandle<Backend, Ret(Args...)> fn, CallArgs... args) {
+        static_assert(!std::is_void_v<Ret>,
+                      "Cannot store the result of a void function");
+        calls_.push_back([out, fn, args...]() { *out = fn(args...); });
+    }
+
+    size_t size() const {
+        return calls_.size();
+    }
+
+    // Run all queued calls in order. The batch is empty afterwards.
+    void run() {
+        for (auto& call : calls_) {
+            call();
+        }
+        calls_.clear();
+    }
+};
+
 }  // namespace sbox
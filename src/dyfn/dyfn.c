@@ -82,6 +82,60 @@ bool dyfn_prep_call(struct DyfnCallArgs* call, void* func,
     return true;
 }
 
+bool dyfn_plan(struct DyfnCallPlan* plan, enum DyfnType ret_type, int nargs,
+               const enum DyfnType* arg_types) {
+    if (nargs < 0 || nargs > DYFN_MAX_ARGS)
+        return false;
+
+    memset(plan, 0, sizeof(*plan));
+    plan->ret_type = ret_type;
+    plan->ret_class = dyfn_classify(ret_type);
+    plan->nargs = nargs;
+
+    // Same assignment as dyfn_prep_call
+    const int max_stack =
+        (int) (sizeof(((struct DyfnCallArgs*) 0)->stack_args) /
+               sizeof(uint64_t));
+    for (int i = 0; i < nargs; i++) {
+        enum DyfnClass cls = dyfn_classify(arg_types[i]);
+        bool is_float = cls == DYFN_CLASS_FLOAT || cls == DYFN_CLASS_DOUBLE;
+        size_t dest;
+        if (is_float && plan->float_count < DYFN_FLOAT_ARG_REGS) {
+            dest = offsetof(struct DyfnCallArgs, float_regs) +
+                   plan->float_count++ * sizeof(uint64_t);
+        } else if (!is_float && plan->int_count < DYFN_INT_ARG_REGS) {
+            dest = offsetof(struct DyfnCallArgs, int_regs) +
+                   plan->int_count++ * sizeof(uint64_t);
+        } else {
+            if (plan->stack_count >= max_stack)
+                return false;
+            dest = offsetof(struct DyfnCallArgs, stack_args) +
+                   plan->stack_count++ * sizeof(uint64_t);
+        }
+        plan->arg_dest[i] = dest;
+        plan->arg_size[i] = dyfn_type_size(arg_types[i]);
+    }
+    return true;
+}
+
+void dyfn_prep_planned(struct DyfnCallArgs* call,
+                       const struct DyfnCallPlan* plan, void* func,
+                       const char* args) {
+    call->int_count = plan->int_count;
+    call->float_count = plan->float_count;
+    call->stack_count = plan->stack_count;
+    call->func = func;
+    call->ret_class = plan->ret_class;
+
+    // Unused registers are loaded but never read by the callee, so only the
+    // argument slots need to be written
+    for (int i = 0; i < plan->nargs; i++) {
+        uint64_t* slot = (uint64_t*) ((char*) call + plan->arg_dest[i]);
+        *slot = 0;
+        memcpy(slot, args + i * sizeof(uint64_t), plan->arg_size[i]);
+    }
+}
+
 void dyfn_store_result(const struct DyfnCallResult* result,
                        enum DyfnType ret_type, void* out) {
     enum DyfnClass cls = dyfn_classify(ret_type);
@@ -58,6 +58,19 @@ struct DyfnCallResult {
     double float_val;
 };
 
+// A signature classified ahead of time, so that each call only copies its
+// arguments into place (see dyfn_prep_planned).
+struct DyfnCallPlan {
+    enum DyfnType ret_type;
+    int ret_class;
+    int nargs;
+    int int_count;
+    int float_count;
+    int stack_count;
+    uint16_t arg_dest[DYFN_MAX_ARGS];  // Offset of each arg in DyfnCallArgs
+    uint8_t arg_size[DYFN_MAX_ARGS];
+};
+
 // Classify a type into INT/FLOAT/DOUBLE/VOID.
 enum DyfnClass dyfn_classify(enum DyfnType type);
 
@@ -69,6 +82,16 @@ bool dyfn_prep_call(struct DyfnCallArgs* call, void* func,
                     enum DyfnType ret_type, int nargs,
                     const enum DyfnType* arg_types, void** arg_values);
 
+// Classify a signature once for dyfn_prep_planned. Returns false if the
+// arguments do not fit in registers and stack slots.
+bool dyfn_plan(struct DyfnCallPlan* plan, enum DyfnType ret_type, int nargs,
+               const enum DyfnType* arg_types);
+
+// Prepare call from a plan. Argument i is read from args + 8 * i.
+void dyfn_prep_planned(struct DyfnCallArgs* call,
+                       const struct DyfnCallPlan* plan, void* func,
+                       const char* args);
+
 // Store result from DyfnCallResult into a buffer based on ret_type.
 void dyfn_store_result(const struct DyfnCallResult* result,
                        enum DyfnType ret_type, void* out);
@@ -2,12 +2,18 @@
 
 #include "pbox.h"
 
+#include "pbox_fdmap.h"
+#include "pbox_heap.h"
+#include "pbox_index.h"
 #include "pbox_internal.h"
 #include "pbox_procmaps.h"
+#include "pbox_window.h"
 
 #include <assert.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <pthread.h>
+#include <sched.h>
 #include <signal.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -15,11 +21,12 @@
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-#define PBOX_FD_DIRECT_MAX 128
-#define PBOX_MAX_CALLBACKS 64
+#define PBOX_VM_IOV_MAX 64  // Regions per process_vm_readv/writev call
 
 struct PBoxCallback {
     pbox_fn_t func_ptr;
@@ -28,11 +35,30 @@ struct PBoxCallback {
     int nargs;
     enum PBoxType arg_types[PBOX_MAX_ARGS];
     void* sandbox_closure;
+    int oneway;  // Invocations are queued (see pbox_register_oneway_callback)
 };
 
-struct PBoxFdEntry {
-    int host_fd;
-    int sandbox_fd;
+// A call signature described to the sandbox (see pbox_describe_call)
+struct PBoxCallDesc {
+    enum PBoxType ret_type;
+    int nargs;
+    enum PBoxType arg_types[PBOX_MAX_ARGS];
+};
+
+// Identity region owned by one thread's arena. Scratch chunks are bump
+// allocated and recycled by pbox_idmem_reset. Pool chunks are split into
+// blocks of a single size class for pbox_idmem_malloc/pbox_idmem_free.
+// The bookkeeping lives here in host memory, where the sandbox can't
+// reach it.
+struct PBoxIdmemChunk {
+    struct PBoxIdmemChunk* next;
+    char* base;
+    size_t size;
+    size_t used;        // Scratch: bump offset. Pool: live blocks.
+    size_t block_size;  // Pool only, 0 for scratch chunks
+    size_t nblocks;
+    size_t hint;     // Pool only: bitmap word to search first
+    uint64_t* live;  // Pool only: bitmap of allocated blocks
 };
 
 struct PBoxThreadChannel {
@@ -40,10 +66,24 @@ struct PBoxThreadChannel {
     int shm_fd;
     struct PBox* box;  // Back-pointer for destructor
 
-    // Identity-mapped arena
-    void* idmem_base;
-    size_t idmem_size;
-    size_t idmem_offset;
+    // Identity-mapped arena, only touched by the owning thread
+    struct PBoxIdmemChunk* idmem_scratch;  // Oldest first
+    struct PBoxIdmemChunk* idmem_current;  // Scratch chunk being bumped
+    struct PBoxIdmemChunk* idmem_pools;
+    struct PBoxIdmemStats idmem_stats;
+    size_t idmem_scratch_used;  // Scratch bytes handed out since reset
+    size_t idmem_pool_live;     // Blocks allocated from pool chunks
+
+    // Async calls (see pbox_call_async). Token t occupies ring slot
+    // (t - 1) % PBOX_RING_SLOTS until it is claimed or the slot is reused.
+    uint64_t ring_seq;  // Last token issued
+    uint64_t slot_token[PBOX_RING_SLOTS];  // Unclaimed token per slot, or 0
+
+    // Nesting depth of operations using the channel on the current thread.
+    // Shared channels go back to the free list when it drops to zero.
+    int borrows;
+    uint32_t shared_index;   // Position in box->shared
+    atomic_uint free_next;   // Next free channel's index + 1, or 0
 };
 
 struct PBox {
@@ -52,8 +92,9 @@ struct PBox {
     int control_shm_fd;
 
     pid_t pid;
+    int pidfd;    // Sandboxes forked by a zygote are not our children
     int sock_fd;  // Unix socket for fd passing
-    pthread_t watcher_thread;
+    struct PBoxWatch watch;  // Registration with the reaper
 
     // Thread-local channel support
     pthread_key_t channel_key;
@@ -73,30 +114,160 @@ struct PBox {
     void* sym_munmap;
     void* sym_memcpy;
     void* sym_close;
+    void* sym_mprotect;
+
+    // Shared heap serving the sandbox's malloc (base is NULL if unavailable)
+    struct PBoxHeap heap;
+
+    // Reserved range that identity mappings are carved from
+    struct PBoxWindow window;
 
-    // Fd mapping: direct table for small fds, dynamic vector for large fds
+    // Other identity-mapped regions, for pbox_in_idmem
+    struct PBoxRegionIndex regions;
+
+    // Fds sent to the sandbox. fd_lock serializes transfers over sock_fd,
+    // since the sandbox takes whichever message comes next.
     pthread_mutex_t fd_lock;
-    int fd_direct[PBOX_FD_DIRECT_MAX];  // -1 = not mapped
-    struct PBoxFdEntry* fd_overflow;
-    size_t fd_overflow_count;
-    size_t fd_overflow_cap;
+    struct PBoxFdMap fds;
 
     // Callback registry
     pthread_mutex_t callback_lock;
     struct PBoxCallback callbacks[PBOX_MAX_CALLBACKS];
     atomic_int callback_count;
 
+    // Call descriptors, added under callback_lock. Entries below
+    // call_desc_count never change.
+    struct PBoxCallDesc call_descs[PBOX_MAX_CALL_DESCS];
+    atomic_int call_desc_count;
+
+    // Wait policy (see pbox_set_wait_policy). The host side reads it from
+    // here; the sandbox side gets a copy in each channel.
+    atomic_uint spin_max_ns;
+    atomic_int spin_adaptive;
+
+    // Busy-poll mode (see pbox_set_busy_poll). Guarded by channel_lock.
+    int busy_poll;
+    struct PBoxWaitPolicy saved_policy;  // Restored when busy-poll ends
+    int* poll_cpus;  // CPUs for workers to poll on, handed out round-robin
+    size_t poll_cpu_count;
+    size_t poll_next;
+
+    // Cleared if process_vm_readv/writev on the sandbox is not permitted,
+    // after which copies go through the channel.
+    atomic_int vm_copy;
+
+    // Idle worker channels, spawned ahead of time for new threads to claim
+    // (see PBoxOptions). The process-wide refill thread tops the pool back
+    // up; refill_next and refill_queued are guarded by refill_lock.
+    pthread_mutex_t pool_lock;
+    struct PBoxThreadChannel** idle_channels;
+    size_t idle_count;
+    size_t idle_target;
+    int pool_stop;  // Set once refilling should stop
+    struct PBox* refill_next;
+    int refill_queued;
+
+    // Shared channels (PBoxOptions.max_channels). Threads borrow a channel
+    // for each call from a lock-free free list instead of owning one.
+    size_t shared_max;  // 0 if every thread has its own channel
+    struct PBoxThreadChannel** shared;  // Created channels, by index
+    size_t shared_count;                // Guarded by channel_lock
+    _Atomic uint64_t free_head;  // ABA tag << 32 | (index + 1), or 0 tag
+    atomic_int free_seq;         // Bumped on every release, for waiters
+    atomic_int free_waiters;
+
     // Set when intentionally destroying (suppresses signal message)
     atomic_int destroying;
+
+    // Set by the reaper once the sandbox has exited. From then on every
+    // channel is kept DEAD, so that no host thread waits on it.
+    atomic_int dead;
 };
 
-static void* watcher_thread_fn(void* arg) {
-    struct PBox* box = arg;
-    int status;
-    waitpid(box->pid, &status, 0);
+// Host-side wait policy
+static struct PBoxWaitPolicy host_policy(const struct PBox* box) {
+    struct PBoxWaitPolicy policy = {
+        .spin_max_ns =
+            atomic_load_explicit(&box->spin_max_ns, memory_order_relaxed),
+        .adaptive =
+            atomic_load_explicit(&box->spin_adaptive, memory_order_relaxed),
+    };
+    return policy;
+}
+
+// Wait for the channel to reach state `expected`. Returns -1 if the sandbox
+// died first.
+static int host_wait_for_state(struct PBox* box, struct PBoxChannel* ch,
+                               int expected) {
+    struct PBoxWaitPolicy policy = host_policy(box);
+    int state = atomic_load(&ch->state);
+    while (state != expected) {
+        if (state == PBOX_STATE_DEAD)
+            return -1;
+        state = pbox_wait_for_change(ch, PBOX_SIDE_HOST, policy, state);
+    }
+    return 0;
+}
+
+// Hand the channel to the sandbox. If the reaper has already marked the
+// channels dead, this would undo it, so put DEAD back: either the reaper
+// sees our state and overwrites it, or we see its flag.
+static void host_set_state(struct PBox* box, struct PBoxChannel* ch,
+                           int state) {
+    pbox_set_state(ch, state);
+    if (atomic_load(&box->dead))
+        pbox_set_state(ch, PBOX_STATE_DEAD);
+}
+
+// Wait for the response to a control channel request and return the channel
+// to IDLE. Returns -1 if the sandbox died first, leaving the state DEAD.
+static int control_await_response(struct PBox* box) {
+    struct PBoxChannel* ctrl = box->control_channel;
+    struct PBoxWaitPolicy policy = host_policy(box);
+    int state = atomic_load(&ctrl->state);
+    while (state != PBOX_STATE_RESPONSE) {
+        if (state == PBOX_STATE_DEAD)
+            return -1;
+        state = pbox_wait_for_change(ctrl, PBOX_SIDE_HOST, policy, state);
+    }
+    int expected = PBOX_STATE_RESPONSE;
+    atomic_compare_exchange_strong(&ctrl->state, &expected, PBOX_STATE_IDLE);
+    return 0;
+}
+
+// Publish the current wait policy to the sandbox side of a channel
+static void init_channel_policy(struct PBox* box, struct PBoxChannel* ch) {
+    atomic_store_explicit(&ch->sandbox_spin_max_ns,
+                          atomic_load(&box->spin_max_ns),
+                          memory_order_relaxed);
+    atomic_store_explicit(&ch->sandbox_spin_adaptive,
+                          atomic_load(&box->spin_adaptive),
+                          memory_order_relaxed);
+}
+
+// Give a worker channel the next of the busy-poll CPUs, or none if there
+// are none (must hold channel_lock)
+static void assign_poll_cpu(struct PBox* box, struct PBoxChannel* ch) {
+    int cpu = 0;
+    if (box->poll_cpu_count > 0)
+        cpu = box->poll_cpus[box->poll_next++ % box->poll_cpu_count] + 1;
+    atomic_store_explicit(&ch->sandbox_cpu, cpu, memory_order_relaxed);
+}
+
+// Kill the sandbox process. Its pid may be reused once it is reaped, which
+// for a zygote's sandbox happens behind our back, but its pidfd may not.
+static void kill_sandbox(struct PBox* box) {
+    syscall(SYS_pidfd_send_signal, box->pidfd, SIGKILL, NULL, 0);
+}
 
+// Called on the reaper thread when the sandbox exits
+static void sandbox_exited(struct PBoxWatch* watch, int status) {
+    struct PBox* box = watch->arg;
     if (!atomic_load(&box->destroying)) {
-        if (WIFSIGNALED(status)) {
+        if (status < 0) {
+            // Forked by a zygote, which collects the exit status
+            fprintf(stderr, "pbox: sandbox exited\n");
+        } else if (WIFSIGNALED(status)) {
             int sig = WTERMSIG(status);
             fprintf(stderr, "pbox: sandbox killed by signal %d", sig);
             if (sig == SIGSYS)
@@ -108,10 +279,37 @@ static void* watcher_thread_fn(void* arg) {
         }
     }
 
-    pbox_set_state(&box->control_channel->state, PBOX_STATE_DEAD);
-    return NULL;
+    atomic_store(&box->dead, 1);
+    pbox_set_state(box->control_channel, PBOX_STATE_DEAD);
+
+    // Wake threads blocked in calls on worker channels. Whoever holds the
+    // lock is waiting on the control channel at worst, and gives up now
+    // that it is dead.
+    pthread_mutex_lock(&box->channel_lock);
+    for (size_t i = 0; i < box->channel_count; i++)
+        pbox_set_state(box->channels[i]->channel, PBOX_STATE_DEAD);
+    pthread_mutex_unlock(&box->channel_lock);
+
+    // Threads waiting for a shared channel give up once they see it
+    atomic_fetch_add(&box->free_seq, 1);
+    pbox_futex_wake_all(&box->free_seq);
 }
 
+// Forward declarations
+static void ring_quiesce(struct PBox* box, struct PBoxThreadChannel* tch);
+static void setup_window(struct PBox* box, size_t size);
+static void setup_shared_heap(struct PBox* box);
+static int pbox_send_fd_on_channel(struct PBox* box, struct PBoxChannel* ch,
+                                   int fd);
+static size_t dlsym_many_on_channel(struct PBox* box, struct PBoxChannel* ch,
+                                    const char* const* symbols, size_t count,
+                                    void** addrs);
+static void idmem_release(struct PBox* box, struct PBoxThreadChannel* tch);
+static void idmem_release_pools(struct PBox* box,
+                                struct PBoxThreadChannel* tch);
+static void idmem_rewind(struct PBoxThreadChannel* tch);
+static void shared_recycle(struct PBox* box, struct PBoxThreadChannel* tch);
+
 // TLS destructor - called when a host thread exits
 static void channel_destructor(void* ptr) {
     if (!ptr)
@@ -120,16 +318,22 @@ static void channel_destructor(void* ptr) {
     struct PBoxThreadChannel* tch = ptr;
     struct PBox* box = tch->box;
 
-    // Signal the sandbox worker to exit
-    pbox_set_state(&tch->channel->state, PBOX_STATE_EXIT);
+    if (box->shared_max) {
+        shared_recycle(box, tch);
+        return;
+    }
 
-    // Unmap host side of identity region only. The worker was just told
-    // to exit, so we can't send further requests on this channel.
-    // Using pbox_munmap_identity here would create a throwaway channel
-    // and could hang if the sandbox is unresponsive. The sandbox will
-    // clean up its own mappings when it exits.
-    if (tch->idmem_base)
-        munmap(tch->idmem_base, tch->idmem_size);
+    // Let async calls still in flight finish, then signal the sandbox
+    // worker to exit
+    ring_quiesce(box, tch);
+    pbox_set_state(tch->channel, PBOX_STATE_EXIT);
+
+    // Release identity regions without this channel: the worker was just
+    // told to exit, so we can't send further requests on it. Using
+    // pbox_munmap_identity here would create a throwaway channel. Window
+    // blocks are reset in the sandbox over the control channel; other
+    // mappings stay there until the sandbox exits.
+    idmem_release(box, tch);
 
     // Unmap and close
     munmap(tch->channel, sizeof(struct PBoxChannel));
@@ -148,11 +352,6 @@ static void channel_destructor(void* ptr) {
     free(tch);
 }
 
-// Forward declarations
-static int pbox_send_fd_on_channel(struct PBox* box, struct PBoxChannel* ch,
-                                   int fd);
-static void* pbox_dlsym_control(struct PBox* box, const char* symbol);
-
 // Create a new worker channel (must hold channel_lock)
 static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
     // Create shared memory for new channel
@@ -175,6 +374,8 @@ static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
     }
 
     atomic_store(&ch->state, PBOX_STATE_IDLE);
+    init_channel_policy(box, ch);
+    assign_poll_cpu(box, ch);
 
     // Send shm_fd to sandbox via control channel
     int sandbox_shm_fd =
@@ -190,19 +391,27 @@ static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
     ctrl->request_type = PBOX_REQ_SPAWN_WORKER;
     ctrl->worker_shm_fd = sandbox_shm_fd;
 
-    pbox_set_state(&ctrl->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_state(&ctrl->state, PBOX_STATE_RESPONSE);
-    atomic_store(&ctrl->state, PBOX_STATE_IDLE);
+    host_set_state(box, ctrl, PBOX_STATE_REQUEST);
+    if (control_await_response(box) < 0) {
+        munmap(ch, sizeof(struct PBoxChannel));
+        close(shm_fd);
+        return NULL;
+    }
 
     // Wait for worker to set sandbox_channel_addr (indicates it's ready)
     while (ch->sandbox_channel_addr == 0) {
+        if (atomic_load(&ctrl->state) == PBOX_STATE_DEAD) {
+            munmap(ch, sizeof(struct PBoxChannel));
+            close(shm_fd);
+            return NULL;
+        }
         PAUSE();
     }
 
     // Allocate thread channel struct
     struct PBoxThreadChannel* tch = malloc(sizeof(struct PBoxThreadChannel));
     if (!tch) {
-        pbox_set_state(&ch->state, PBOX_STATE_EXIT);
+        pbox_set_state(ch, PBOX_STATE_EXIT);
         munmap(ch, sizeof(struct PBoxChannel));
         close(shm_fd);
         return NULL;
@@ -212,10 +421,21 @@ static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
     tch->shm_fd = shm_fd;
     tch->box = box;
 
-    // Initialize identity-mapped arena (non-fatal if it fails)
-    tch->idmem_base = NULL;
-    tch->idmem_size = 0;
-    tch->idmem_offset = 0;
+    // Identity-mapped arena, populated on first use
+    tch->idmem_scratch = NULL;
+    tch->idmem_current = NULL;
+    tch->idmem_pools = NULL;
+    memset(&tch->idmem_stats, 0, sizeof(tch->idmem_stats));
+    tch->idmem_scratch_used = 0;
+
+    tch->idmem_pool_live = 0;
+
+    tch->ring_seq = 0;
+    memset(tch->slot_token, 0, sizeof(tch->slot_token));
+
+    tch->borrows = 0;
+    tch->shared_index = 0;
+    atomic_init(&tch->free_next, 0);
 
     // Add to channels list
     if (box->channel_count >= box->channel_cap) {
@@ -223,7 +443,7 @@ static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
         struct PBoxThreadChannel** new_channels =
             realloc(box->channels, new_cap * sizeof(struct PBoxThreadChannel*));
         if (!new_channels) {
-            pbox_set_state(&ch->state, PBOX_STATE_EXIT);
+            pbox_set_state(ch, PBOX_STATE_EXIT);
             munmap(ch, sizeof(struct PBoxChannel));
             close(shm_fd);
             free(tch);
@@ -237,46 +457,348 @@ static struct PBoxThreadChannel* create_channel_locked(struct PBox* box) {
     return tch;
 }
 
-// Get or create thread-local channel
-static struct PBoxChannel* get_or_create_channel(struct PBox* box) {
-    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+// One refill thread for every sandbox in the process, started with the
+// first pool, so that pools cost no thread per sandbox. Sandboxes whose
+// pool is short wait in a queue and get one channel per turn. Like the
+// reaper, the thread never exits.
+static pthread_mutex_t refill_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t refill_cond = PTHREAD_COND_INITIALIZER;
+static struct PBox* refill_head;
+static struct PBox* refill_tail;
+static struct PBox* refill_current;  // Being topped up, outside refill_lock
+static pthread_once_t refill_once = PTHREAD_ONCE_INIT;
+
+// Queue a sandbox for its pool to be topped up (must hold refill_lock)
+static void refill_enqueue(struct PBox* box) {
+    if (box->refill_queued)
+        return;
+    box->refill_queued = 1;
+    box->refill_next = NULL;
+    if (refill_tail)
+        refill_tail->refill_next = box;
+    else
+        refill_head = box;
+    refill_tail = box;
+    pthread_cond_broadcast(&refill_cond);
+}
+
+// Add one channel to a sandbox's pool. Returns 1 if it is still short.
+static int refill_one(struct PBox* box) {
+    pthread_mutex_lock(&box->pool_lock);
+    int short_of = !box->pool_stop && box->idle_count < box->idle_target;
+    pthread_mutex_unlock(&box->pool_lock);
+    if (!short_of)
+        return 0;
+
+    pthread_mutex_lock(&box->channel_lock);
+    struct PBoxThreadChannel* tch = create_channel_locked(box);
+    pthread_mutex_unlock(&box->channel_lock);
+
+    pthread_mutex_lock(&box->pool_lock);
     if (tch) {
-        return tch->channel;
+        box->idle_channels[box->idle_count++] = tch;
+    } else {
+        // Sandbox died or out of resources: stop refilling
+        box->pool_stop = 1;
+    }
+    short_of = !box->pool_stop && box->idle_count < box->idle_target;
+    pthread_mutex_unlock(&box->pool_lock);
+    return short_of;
+}
+
+static void* refill_thread_fn(void* arg) {
+    (void) arg;
+    pthread_mutex_lock(&refill_lock);
+    for (;;) {
+        struct PBox* box = refill_head;
+        if (!box) {
+            pthread_cond_wait(&refill_cond, &refill_lock);
+            continue;
+        }
+        refill_head = box->refill_next;
+        if (!refill_head)
+            refill_tail = NULL;
+        box->refill_queued = 0;
+        refill_current = box;
+        pthread_mutex_unlock(&refill_lock);
+
+        int again = refill_one(box);
+
+        pthread_mutex_lock(&refill_lock);
+        refill_current = NULL;
+        if (again)
+            refill_enqueue(box);
+        pthread_cond_broadcast(&refill_cond);  // For refill_forget
+    }
+    return NULL;
+}
+
+static void refill_start(void) {
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, refill_thread_fn, NULL) != 0) {
+        perror("pbox: pthread_create");
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Have the refill thread top up a sandbox's pool
+static void refill_request(struct PBox* box) {
+    pthread_once(&refill_once, refill_start);
+    pthread_mutex_lock(&refill_lock);
+    refill_enqueue(box);
+    pthread_mutex_unlock(&refill_lock);
+}
+
+// Take a sandbox off the refill queue and wait until the refill thread is
+// done with it. pool_stop must already be set, so it isn't queued again.
+static void refill_forget(struct PBox* box) {
+    pthread_mutex_lock(&refill_lock);
+    if (box->refill_queued) {
+        struct PBox** link = &refill_head;
+        struct PBox* prev = NULL;
+        while (*link != box) {
+            prev = *link;
+            link = &(*link)->refill_next;
+        }
+        *link = box->refill_next;
+        if (refill_tail == box)
+            refill_tail = prev;
+        box->refill_queued = 0;
     }
+    while (refill_current == box)
+        pthread_cond_wait(&refill_cond, &refill_lock);
+    pthread_mutex_unlock(&refill_lock);
+}
+
+// Take an idle channel from the pool, or return NULL if it is empty
+static struct PBoxThreadChannel* pool_claim(struct PBox* box) {
+    if (!box->idle_target)
+        return NULL;
+    struct PBoxThreadChannel* tch = NULL;
+    pthread_mutex_lock(&box->pool_lock);
+    if (box->idle_count > 0)
+        tch = box->idle_channels[--box->idle_count];
+    int refill = tch && !box->pool_stop;
+    pthread_mutex_unlock(&box->pool_lock);
+    if (refill)
+        refill_request(box);
+    return tch;
+}
+
+// Spawn the initial idle channels and have the refill thread keep the pool
+// full. Non-fatal: threads create their own channels when the pool is empty.
+static void setup_channel_pool(struct PBox* box, size_t count) {
+    box->idle_channels = calloc(count, sizeof(struct PBoxThreadChannel*));
+    if (!box->idle_channels)
+        return;
 
-    // Need to create a new channel - lock protects channels list and control
-    // channel
     pthread_mutex_lock(&box->channel_lock);
-    tch = create_channel_locked(box);
+    while (box->idle_count < count) {
+        struct PBoxThreadChannel* tch = create_channel_locked(box);
+        if (!tch)
+            break;
+        box->idle_channels[box->idle_count++] = tch;
+    }
     pthread_mutex_unlock(&box->channel_lock);
 
-    if (!tch) {
-        return NULL;
+    box->idle_target = count;
+    if (box->idle_count < count)
+        refill_request(box);
+}
+
+// Push a shared channel onto the free list and wake a waiting thread
+static void free_push(struct PBox* box, struct PBoxThreadChannel* tch) {
+    uint64_t head = atomic_load(&box->free_head);
+    uint64_t next;
+    do {
+        atomic_store_explicit(&tch->free_next, (uint32_t) head,
+                              memory_order_relaxed);
+        next = ((head >> 32) + 1) << 32 | (tch->shared_index + 1);
+    } while (!atomic_compare_exchange_weak(&box->free_head, &head, next));
+
+    atomic_fetch_add(&box->free_seq, 1);
+    if (atomic_load(&box->free_waiters) > 0)
+        pbox_futex_wake(&box->free_seq);
+}
+
+// Pop a shared channel off the free list, or return NULL if it is empty.
+// Channels are only freed by pbox_destroy, so reading free_next of a
+// channel another thread has just popped is harmless; the tag bumped on
+// every push makes the stale head fail the exchange.
+static struct PBoxThreadChannel* free_pop(struct PBox* box) {
+    uint64_t head = atomic_load(&box->free_head);
+    while ((uint32_t) head) {
+        struct PBoxThreadChannel* tch = box->shared[(uint32_t) head - 1];
+        uint64_t next =
+            (head & ~(uint64_t) UINT32_MAX) |
+            atomic_load_explicit(&tch->free_next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak(&box->free_head, &head, next))
+            return tch;
+    }
+    return NULL;
+}
+
+// Create another shared channel, or return NULL at the limit
+static struct PBoxThreadChannel* shared_create(struct PBox* box) {
+    struct PBoxThreadChannel* tch = NULL;
+    pthread_mutex_lock(&box->channel_lock);
+    if (box->shared_count < box->shared_max) {
+        tch = create_channel_locked(box);
+        if (tch) {
+            tch->shared_index = (uint32_t) box->shared_count;
+            box->shared[box->shared_count++] = tch;
+        }
+    }
+    pthread_mutex_unlock(&box->channel_lock);
+    return tch;
+}
+
+// Take a free shared channel, creating one if under the limit and waiting
+// for a release otherwise. Returns NULL if the sandbox is dead.
+static struct PBoxThreadChannel* shared_borrow(struct PBox* box) {
+    for (;;) {
+        struct PBoxThreadChannel* tch = free_pop(box);
+        if (!tch)
+            tch = shared_create(box);
+        if (tch)
+            return tch;
+
+        int seq = atomic_load(&box->free_seq);
+        if (!pbox_alive(box))
+            return NULL;
+        pthread_mutex_lock(&box->channel_lock);
+        size_t count = box->shared_count;
+        pthread_mutex_unlock(&box->channel_lock);
+        if (count == 0)
+            return NULL;  // Out of resources with no channel to wait for
+
+        // A release after reading seq changes it, so the wait returns
+        atomic_fetch_add(&box->free_waiters, 1);
+        if (!(uint32_t) atomic_load(&box->free_head))
+            pbox_futex_wait(&box->free_seq, seq);
+        atomic_fetch_sub(&box->free_waiters, 1);
+    }
+}
+
+// Whether a shared channel still holds state tied to the calling thread:
+// unclaimed async calls, or identity memory it handed out
+static int channel_pinned(const struct PBoxThreadChannel* tch) {
+    if (tch->idmem_scratch_used > 0 || tch->idmem_pool_live > 0)
+        return 1;
+    for (int i = 0; i < PBOX_RING_SLOTS; i++) {
+        if (tch->slot_token[i])
+            return 1;
+    }
+    return 0;
+}
+
+// Give the calling thread's shared channel back to the free list if it is
+// not in use and holds nothing the thread may still come back for
+static void channel_release_idle(struct PBox* box,
+                                 struct PBoxThreadChannel* tch) {
+    if (!box->shared_max || !tch || tch->borrows > 0 || channel_pinned(tch))
+        return;
+    pthread_setspecific(box->channel_key, NULL);
+    free_push(box, tch);
+}
+
+// Return a channel obtained with get_or_create_thread_channel or
+// get_or_create_channel
+static void channel_return(struct PBox* box) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (!tch)
+        return;
+    tch->borrows--;
+    channel_release_idle(box, tch);
+}
+
+// A thread exited holding a shared channel: drop what it left behind and
+// put the channel back for other threads
+static void shared_recycle(struct PBox* box, struct PBoxThreadChannel* tch) {
+    ring_quiesce(box, tch);
+    memset(tch->slot_token, 0, sizeof(tch->slot_token));
+    idmem_release_pools(box, tch);
+    idmem_rewind(tch);
+    tch->borrows = 0;
+    free_push(box, tch);
+}
+
+// Spawn the shared channels up front (PBoxOptions.prespawn_channels)
+static void setup_shared_prespawn(struct PBox* box, size_t count) {
+    if (count > box->shared_max)
+        count = box->shared_max;
+    for (size_t i = 0; i < count; i++) {
+        struct PBoxThreadChannel* tch = shared_create(box);
+        if (!tch)
+            break;
+        free_push(box, tch);
+    }
+}
+
+// Get thread-local channel struct (not just the channel pointer). Every
+// successful call must be paired with channel_return.
+static struct PBoxThreadChannel* get_or_create_thread_channel(
+    struct PBox* box) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (tch) {
+        tch->borrows++;
+        return tch;
+    }
+
+    if (box->shared_max) {
+        tch = shared_borrow(box);
+    } else {
+        tch = pool_claim(box);
+        if (!tch) {
+            // Need to create a new channel - lock protects channels list
+            // and control channel
+            pthread_mutex_lock(&box->channel_lock);
+            tch = create_channel_locked(box);
+            pthread_mutex_unlock(&box->channel_lock);
+        }
     }
 
+    if (!tch)
+        return NULL;
+
+    tch->borrows = 1;
     pthread_setspecific(box->channel_key, tch);
+    return tch;
+}
+
+// Get or create thread-local channel, ready for a new request. Async calls
+// still in flight on it are completed first (their results stay in the ring).
+// Every successful call must be paired with channel_return.
+static struct PBoxChannel* get_or_create_channel(struct PBox* box) {
+    struct PBoxThreadChannel* tch = get_or_create_thread_channel(box);
+    if (!tch)
+        return NULL;
+
+    ring_quiesce(box, tch);
     return tch->channel;
 }
 
 struct PBox* pbox_create(const char* sandbox_executable) {
+    return pbox_create_with_options(sandbox_executable, NULL);
+}
+
+struct PBox* pbox_create_with_options(const char* sandbox_executable,
+                                      const struct PBoxOptions* options) {
     struct PBox* box = malloc(sizeof(struct PBox));
     if (!box) {
         return NULL;
     }
 
     atomic_init(&box->destroying, 0);
+    atomic_init(&box->dead, 0);
 
-    // Initialize fd mapping.
+    // Initialize fd passing.
     if (pthread_mutex_init(&box->fd_lock, NULL) != 0) {
         perror("pbox: pthread_mutex_init");
         free(box);
         return NULL;
     }
-    for (int i = 0; i < PBOX_FD_DIRECT_MAX; i++)
-        box->fd_direct[i] = -1;
-    box->fd_overflow = NULL;
-    box->fd_overflow_count = 0;
-    box->fd_overflow_cap = 0;
 
     // Initialize callback registry.
     if (pthread_mutex_init(&box->callback_lock, NULL) != 0) {
@@ -286,6 +808,19 @@ struct PBox* pbox_create(const char* sandbox_executable) {
         return NULL;
     }
     atomic_init(&box->callback_count, 0);
+    atomic_init(&box->call_desc_count, 0);
+
+    // Spinning only pays off when the peer can run concurrently.
+    atomic_init(&box->spin_max_ns,
+                sysconf(_SC_NPROCESSORS_ONLN) > 1 ? PBOX_SPIN_DEFAULT_NS : 0);
+    atomic_init(&box->spin_adaptive, 1);
+    atomic_init(&box->vm_copy, 1);
+    box->busy_poll = 0;
+    box->poll_cpus = NULL;
+    box->poll_cpu_count = 0;
+    box->poll_next = 0;
+    box->heap.base = NULL;
+    box->heap.size = 0;
 
     // Initialize channel list.
     box->channels = NULL;
@@ -352,6 +887,7 @@ struct PBox* pbox_create(const char* sandbox_executable) {
 
     // Initialize control channel.
     atomic_store(&box->control_channel->state, PBOX_STATE_IDLE);
+    init_channel_policy(box, box->control_channel);
 
     // Create socket pair for fd passing.
     int sock_fds[2];
@@ -367,10 +903,30 @@ struct PBox* pbox_create(const char* sandbox_executable) {
         return NULL;
     }
 
-    // Fork and exec the sandbox process.
-    box->pid = fork();
+    struct PBoxZygote* zygote = options ? options->zygote : NULL;
+    if (zygote) {
+        // Have the zygote fork it. The sandbox inherits nothing of ours
+        // but the two fds sent with the request.
+        box->pid = pbox_zygote_spawn(zygote, box->control_shm_fd,
+                                     sock_fds[1], &box->pidfd);
+        if (box->pid < 0)
+            fprintf(stderr, "pbox: zygote failed to start sandbox\n");
+    } else {
+        // Spawn the sandbox process, passing it the two fds it needs
+        char fd_str[16], sock_str[16];
+        snprintf(fd_str, sizeof(fd_str), "%d", box->control_shm_fd);
+        snprintf(sock_str, sizeof(sock_str), "%d", sock_fds[1]);
+        char* argv[] = {(char*) sandbox_executable, fd_str, sock_str, NULL};
+        int keep_fds[] = {box->control_shm_fd, sock_fds[1]};
+        box->pid = pbox_spawn(sandbox_executable, argv, keep_fds, 2,
+                              &box->pidfd);
+        if (box->pid < 0)
+            fprintf(stderr, "pbox: failed to start %s: %s\n",
+                    sandbox_executable, strerror(errno));
+    }
     if (box->pid < 0) {
-        perror("pbox: fork");
+        close(sock_fds[0]);
+        close(sock_fds[1]);
         munmap(box->control_channel, sizeof(struct PBoxChannel));
         close(box->control_shm_fd);
         pthread_mutex_destroy(&box->channel_lock);
@@ -381,32 +937,53 @@ struct PBox* pbox_create(const char* sandbox_executable) {
         return NULL;
     }
 
-    if (box->pid == 0) {
-        // Child process.
-        // Mark all FDs >= 3 as close-on-exec to prevent leaking host FDs,
-        // then clear close-on-exec on the two FDs we need to pass.
-        close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
-        fcntl(box->control_shm_fd, F_SETFD, 0);
-        fcntl(sock_fds[1], F_SETFD, 0);
-
-        char fd_str[16], sock_str[16];
-        snprintf(fd_str, sizeof(fd_str), "%d", box->control_shm_fd);
-        snprintf(sock_str, sizeof(sock_str), "%d", sock_fds[1]);
-        execl(sandbox_executable, sandbox_executable, fd_str, sock_str, NULL);
-        perror("pbox: execl");
-        exit(1);
-    }
-
     // Parent: close child's end, keep ours
     close(sock_fds[1]);
     box->sock_fd = sock_fds[0];
 
-    // Start watcher thread to detect sandbox death.
-    if (pthread_create(&box->watcher_thread, NULL, watcher_thread_fn, box) !=
-        0) {
-        perror("pbox: pthread_create");
-        kill(box->pid, SIGKILL);
-        waitpid(box->pid, NULL, 0);
+    pbox_index_init(&box->regions);
+    pbox_fdmap_init(&box->fds);
+    pbox_window_init(&box->window);
+    pthread_mutex_init(&box->pool_lock, NULL);
+    box->idle_channels = NULL;
+    box->idle_count = 0;
+    box->idle_target = 0;
+    box->pool_stop = 0;
+    box->refill_next = NULL;
+    box->refill_queued = 0;
+    box->shared_max = 0;
+    box->shared = NULL;
+    box->shared_count = 0;
+    atomic_init(&box->free_head, 0);
+    atomic_init(&box->free_seq, 0);
+    atomic_init(&box->free_waiters, 0);
+    if (options && options->max_channels > 0) {
+        // Indices must fit the free list head. Without the array threads
+        // fall back to owning a channel each.
+        size_t max = options->max_channels;
+        if (max > UINT32_MAX - 1)
+            max = UINT32_MAX - 1;
+        box->shared = calloc(max, sizeof(struct PBoxThreadChannel*));
+        if (box->shared)
+            box->shared_max = max;
+    }
+
+    // Have the reaper tell us when the sandbox dies.
+    box->watch.pidfd = box->pidfd;
+    box->watch.pid = box->pid;
+    box->watch.reap = !zygote;
+    box->watch.exited = sandbox_exited;
+    box->watch.arg = box;
+    if (pbox_reaper_watch(&box->watch) < 0) {
+        kill_sandbox(box);
+        if (!zygote)
+            waitpid(box->pid, NULL, 0);
+        close(box->pidfd);
+        free(box->shared);
+        pbox_index_destroy(&box->regions);
+        pbox_fdmap_destroy(&box->fds);
+        pbox_window_destroy(&box->window);
+        pthread_mutex_destroy(&box->pool_lock);
         munmap(box->control_channel, sizeof(struct PBoxChannel));
         close(box->control_shm_fd);
         close(box->sock_fd);
@@ -418,36 +995,71 @@ struct PBox* pbox_create(const char* sandbox_executable) {
         return NULL;
     }
 
-    // Cache common symbols (use control channel for initial lookups).
-    pthread_mutex_lock(&box->channel_lock);
-    box->sym_malloc = pbox_dlsym_control(box, "malloc");
-    box->sym_calloc = pbox_dlsym_control(box, "calloc");
-    box->sym_realloc = pbox_dlsym_control(box, "realloc");
-    box->sym_free = pbox_dlsym_control(box, "free");
-    box->sym_mmap = pbox_dlsym_control(box, "mmap");
-    box->sym_munmap = pbox_dlsym_control(box, "munmap");
-    box->sym_memcpy = pbox_dlsym_control(box, "memcpy");
-    box->sym_close = pbox_dlsym_control(box, "close");
-    pthread_mutex_unlock(&box->channel_lock);
+    // Cache common symbols in one exchange on the control channel. All of
+    // a zygote's sandboxes have them at the same addresses, so they are
+    // only looked up in the first.
+    static const char* const common_syms[] = {
+        "malloc", "calloc", "realloc", "free",
+        "mmap",   "munmap", "memcpy",  "close", "mprotect",
+    };
+    size_t nsyms = sizeof(common_syms) / sizeof(common_syms[0]);
+    void* addrs[sizeof(common_syms) / sizeof(common_syms[0])];
+    if (!zygote || !pbox_zygote_get_syms(zygote, addrs, nsyms)) {
+        pthread_mutex_lock(&box->channel_lock);
+        dlsym_many_on_channel(box, box->control_channel, common_syms, nsyms,
+                              addrs);
+        pthread_mutex_unlock(&box->channel_lock);
+        if (zygote && pbox_alive(box))
+            pbox_zygote_put_syms(zygote, addrs, nsyms);
+    }
+    box->sym_malloc = addrs[0];
+    box->sym_calloc = addrs[1];
+    box->sym_realloc = addrs[2];
+    box->sym_free = addrs[3];
+    box->sym_mmap = addrs[4];
+    box->sym_munmap = addrs[5];
+    box->sym_memcpy = addrs[6];
+    box->sym_close = addrs[7];
+    box->sym_mprotect = addrs[8];
+
+    // Non-fatal if these fail: identity mappings are then made one at a
+    // time, and allocations go to the sandbox's libc.
+    size_t window = options ? options->identity_window : 0;
+    if (window != PBOX_IDENTITY_WINDOW_NONE)
+        setup_window(box, window ? window : PBOX_WINDOW_DEFAULT_SIZE);
+    setup_shared_heap(box);
+
+    if (options && options->prespawn_channels > 0) {
+        if (box->shared_max)
+            setup_shared_prespawn(box, options->prespawn_channels);
+        else
+            setup_channel_pool(box, options->prespawn_channels);
+    }
 
     return box;
 }
 
 void pbox_destroy(struct PBox* box) {
+    // Stop refilling the channel pool.
+    pthread_mutex_lock(&box->pool_lock);
+    box->pool_stop = 1;
+    pthread_mutex_unlock(&box->pool_lock);
+
     // Kill the sandbox process.
     atomic_store(&box->destroying, 1);
-    kill(box->pid, SIGKILL);
+    kill_sandbox(box);
 
-    // Wait for watcher thread (which waits for child).
-    pthread_join(box->watcher_thread, NULL);
+    // Wait for the reaper to see it exit. Once it marks the sandbox dead,
+    // a refill in progress gives up.
+    pbox_reaper_wait(&box->watch);
+    refill_forget(box);
 
     // Clean up worker channel resources.
     pthread_mutex_lock(&box->channel_lock);
     for (size_t i = 0; i < box->channel_count; i++) {
         struct PBoxThreadChannel* tch = box->channels[i];
         // Only unmap host side - sandbox is already dead
-        if (tch->idmem_base)
-            munmap(tch->idmem_base, tch->idmem_size);
+        idmem_release(box, tch);
         munmap(tch->channel, sizeof(struct PBoxChannel));
         close(tch->shm_fd);
         free(tch);
@@ -456,17 +1068,26 @@ void pbox_destroy(struct PBox* box) {
     box->channels = NULL;
     box->channel_count = 0;
     pthread_mutex_unlock(&box->channel_lock);
+    free(box->idle_channels);  // Idle channels were freed with the rest
+    free(box->shared);
 
+    if (box->heap.base)
+        munmap(box->heap.base, box->heap.size);
     munmap(box->control_channel, sizeof(struct PBoxChannel));
     close(box->control_shm_fd);
     close(box->sock_fd);
+    close(box->pidfd);
 
+    pbox_index_destroy(&box->regions);
+    pbox_fdmap_destroy(&box->fds);
+    pbox_window_destroy(&box->window);
+    pthread_mutex_destroy(&box->pool_lock);
     pthread_mutex_destroy(&box->channel_lock);
     pthread_mutex_destroy(&box->callback_lock);
     pthread_mutex_destroy(&box->fd_lock);
     pthread_key_delete(box->channel_key);
 
-    free(box->fd_overflow);
+    free(box->poll_cpus);
     free(box);
 }
 
@@ -478,19 +1099,202 @@ int pbox_alive(const struct PBox* box) {
     return atomic_load(&box->control_channel->state) != PBOX_STATE_DEAD;
 }
 
-// Internal: dlsym using control channel (must hold channel_lock)
-static void* pbox_dlsym_control(struct PBox* box, const char* symbol) {
-    struct PBoxChannel* ch = box->control_channel;
+void pbox_set_wait_policy(struct PBox* box,
+                          const struct PBoxWaitPolicy* policy) {
+    pthread_mutex_lock(&box->channel_lock);
+    // An explicit policy replaces busy-poll's, so ending busy-poll later
+    // must not bring back the one from before it
+    box->busy_poll = 0;
+    atomic_store(&box->spin_max_ns, policy->spin_max_ns);
+    atomic_store(&box->spin_adaptive, policy->adaptive);
+
+    init_channel_policy(box, box->control_channel);
+    for (size_t i = 0; i < box->channel_count; i++)
+        init_channel_policy(box, box->channels[i]->channel);
+    pthread_mutex_unlock(&box->channel_lock);
+}
 
-    ch->request_type = PBOX_REQ_DLSYM;
-    strncpy(ch->symbol_name, symbol, PBOX_MAX_SYMBOL_NAME - 1);
-    ch->symbol_name[PBOX_MAX_SYMBOL_NAME - 1] = '\0';
+struct PBoxWaitPolicy pbox_get_wait_policy(const struct PBox* box) {
+    return host_policy(box);
+}
 
-    pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_state(&ch->state, PBOX_STATE_RESPONSE);
-    atomic_store(&ch->state, PBOX_STATE_IDLE);
+int pbox_set_busy_poll(struct PBox* box, uint32_t idle_ns, const int* cpus,
+                       size_t cpu_count) {
+    int* poll_cpus = NULL;
+    if (idle_ns > 0 && cpu_count > 0) {
+        for (size_t i = 0; i < cpu_count; i++) {
+            if (cpus[i] < 0) {
+                errno = EINVAL;
+                return -1;
+            }
+        }
+        poll_cpus = malloc(cpu_count * sizeof(int));
+        if (!poll_cpus)
+            return -1;
+        memcpy(poll_cpus, cpus, cpu_count * sizeof(int));
+    } else {
+        cpu_count = 0;
+    }
+
+    pthread_mutex_lock(&box->channel_lock);
+    if (idle_ns > 0) {
+        if (!box->busy_poll)
+            box->saved_policy = host_policy(box);
+        box->busy_poll = 1;
+        atomic_store(&box->spin_max_ns, idle_ns);
+        atomic_store(&box->spin_adaptive, 0);
+    } else if (box->busy_poll) {
+        box->busy_poll = 0;
+        atomic_store(&box->spin_max_ns, box->saved_policy.spin_max_ns);
+        atomic_store(&box->spin_adaptive, box->saved_policy.adaptive);
+    }
+    free(box->poll_cpus);
+    box->poll_cpus = poll_cpus;
+    box->poll_cpu_count = cpu_count;
+    box->poll_next = 0;
+
+    init_channel_policy(box, box->control_channel);
+    for (size_t i = 0; i < box->channel_count; i++) {
+        init_channel_policy(box, box->channels[i]->channel);
+        assign_poll_cpu(box, box->channels[i]->channel);
+    }
+    pthread_mutex_unlock(&box->channel_lock);
+    return 0;
+}
+
+// The calling thread's CPU's first SMT sibling, or that CPU if it has none
+static int sibling_cpu(void) {
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+        return -1;
+
+    char path[96];
+    snprintf(path, sizeof(path),
+             "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list",
+             cpu);
+    FILE* f = fopen(path, "re");
+    if (!f)
+        return cpu;
+
+    // A list of CPUs and ranges, such as "0,64" or "0-1"
+    int sibling = cpu;
+    int lo, hi;
+    while (sibling == cpu && fscanf(f, "%d", &lo) == 1) {
+        hi = lo;
+        if (fscanf(f, "-%d", &hi) != 1)
+            hi = lo;
+        for (int i = lo; i <= hi; i++) {
+            if (i != cpu) {
+                sibling = i;
+                break;
+            }
+        }
+        if (fgetc(f) != ',')
+            break;
+    }
+    fclose(f);
+    return sibling;
+}
+
+// Internal: have the calling thread's worker run a PBOX_REQ_SET_* request
+// already filled into its channel
+static int worker_sched_request(struct PBox* box, struct PBoxChannel* ch,
+                                int request_type) {
+    ch->request_type = request_type;
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    int result = -ESRCH;
+    if (host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) == 0) {
+        result = ch->sched_result;
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
+    }
+    channel_return(box);
+    if (result < 0) {
+        errno = -result;
+        return -1;
+    }
+    return 0;
+}
+
+int pbox_pin_worker(struct PBox* box, int cpu) {
+    if (cpu == PBOX_CPU_SIBLING) {
+        cpu = sibling_cpu();
+        if (cpu < 0)
+            return -1;
+    } else if (cpu == PBOX_CPU_ANY) {
+        cpu = -1;
+    } else if (cpu < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch) {
+        errno = ESRCH;
+        return -1;
+    }
+    ch->sched_cpu = cpu;
+    return worker_sched_request(box, ch, PBOX_REQ_SET_AFFINITY);
+}
+
+int pbox_set_worker_sched(struct PBox* box, int policy, int priority) {
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch) {
+        errno = ESRCH;
+        return -1;
+    }
+    ch->sched_policy = policy;
+    ch->sched_priority = priority;
+    return worker_sched_request(box, ch, PBOX_REQ_SET_SCHED);
+}
+
+// Internal: look up symbols on a channel the caller owns, packing as many
+// names into each PBOX_REQ_DLSYM_MANY exchange as fit
+static size_t dlsym_many_on_channel(struct PBox* box, struct PBoxChannel* ch,
+                                    const char* const* symbols, size_t count,
+                                    void** addrs) {
+    size_t found = 0;
+    size_t done = 0;
+    while (done < count) {
+        size_t n = 0;
+        size_t used = 0;
+        while (done + n < count && n < PBOX_DLSYM_MANY_MAX) {
+            // Long names are truncated, as in pbox_dlsym
+            const char* name = symbols[done + n];
+            size_t len = strnlen(name, PBOX_MAX_SYMBOL_NAME - 1);
+            if (used + len + 1 > PBOX_MEM_STORAGE)
+                break;
+            memcpy(ch->mem_storage + used, name, len);
+            ch->mem_storage[used + len] = '\0';
+            used += len + 1;
+            n++;
+        }
+
+        ch->request_type = PBOX_REQ_DLSYM_MANY;
+        ch->symbol_count = (int) n;
+        host_set_state(box, ch, PBOX_STATE_REQUEST);
+        int dead;
+        if (ch != box->control_channel) {
+            dead = host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) < 0;
+            if (!dead)
+                atomic_store(&ch->state, PBOX_STATE_IDLE);
+        } else {
+            dead = control_await_response(box) < 0;
+        }
+        if (dead) {
+            for (size_t i = done; i < count; i++)
+                addrs[i] = NULL;
+            return found;
+        }
 
-    return (void*) ch->symbol_addr;
+        const uint64_t* results = (const uint64_t*) ch->arg_storage;
+        for (size_t i = 0; i < n; i++) {
+            addrs[done + i] = (void*) (uintptr_t) results[i];
+            if (addrs[done + i])
+                found++;
+        }
+        done += n;
+    }
+    return found;
 }
 
 void* pbox_dlsym(struct PBox* box, const char* symbol) {
@@ -502,11 +1306,36 @@ void* pbox_dlsym(struct PBox* box, const char* symbol) {
     strncpy(ch->symbol_name, symbol, PBOX_MAX_SYMBOL_NAME - 1);
     ch->symbol_name[PBOX_MAX_SYMBOL_NAME - 1] = '\0';
 
-    pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_state(&ch->state, PBOX_STATE_RESPONSE);
-    atomic_store(&ch->state, PBOX_STATE_IDLE);
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    void* addr = NULL;
+    if (host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) == 0) {
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
+        addr = (void*) ch->symbol_addr;
+    }
+    channel_return(box);
+    return addr;
+}
+
+size_t pbox_dlsym_many(struct PBox* box, const char* const* symbols,
+                       size_t count, void** addrs) {
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch) {
+        for (size_t i = 0; i < count; i++)
+            addrs[i] = NULL;
+        return 0;
+    }
+    size_t found = dlsym_many_on_channel(box, ch, symbols, count, addrs);
+    channel_return(box);
+    return found;
+}
 
-    return (void*) ch->symbol_addr;
+size_t pbox_dlsym_many_control(struct PBox* box, const char* const* symbols,
+                               size_t count, void** addrs) {
+    pthread_mutex_lock(&box->channel_lock);
+    size_t found =
+        dlsym_many_on_channel(box, box->control_channel, symbols, count, addrs);
+    pthread_mutex_unlock(&box->channel_lock);
+    return found;
 }
 
 static size_t pbox_type_size(enum PBoxType type) {
@@ -541,8 +1370,60 @@ static size_t pbox_type_size(enum PBoxType type) {
 }
 
 
+// Number of callbacks being dispatched on this thread
+static __thread int callback_depth;
+
+// Run the one-way callbacks queued on the channel, in order. Each slot is
+// copied out and released before its callback runs, since the sandbox may
+// reuse it as soon as it is released.
+static void drain_oneway(struct PBox* box, struct PBoxChannel* ch) {
+    for (;;) {
+        unsigned done =
+            atomic_load_explicit(&ch->oneway_done, memory_order_relaxed);
+        unsigned head =
+            atomic_load_explicit(&ch->oneway_head, memory_order_acquire);
+        if (head == done)
+            return;
+        if (head - done > PBOX_ONEWAY_SLOTS) {
+            fprintf(stderr, "pbox: sandbox violated callback protocol\n");
+            kill_sandbox(box);
+            return;
+        }
+
+        const struct PBoxOnewaySlot* slot =
+            &ch->oneway[done % PBOX_ONEWAY_SLOTS];
+        int id = slot->callback_id;
+        uint64_t arg_offsets[PBOX_MAX_ARGS];
+        char arg_storage[PBOX_SLOT_ARG_STORAGE];
+        memcpy(arg_offsets, slot->args, sizeof(arg_offsets));
+        memcpy(arg_storage, slot->arg_storage, sizeof(arg_storage));
+        atomic_store_explicit(&ch->oneway_done, done + 1,
+                              memory_order_release);
+
+        if (id < 0 || id >= atomic_load(&box->callback_count) ||
+            !box->callbacks[id].oneway)
+            continue;
+        struct PBoxCallback* cb = &box->callbacks[id];
+        for (int i = 0; i < cb->nargs; i++) {
+            if (arg_offsets[i] > PBOX_SLOT_ARG_STORAGE - sizeof(uint64_t)) {
+                fprintf(stderr, "pbox: sandbox violated callback protocol\n");
+                kill_sandbox(box);
+                return;
+            }
+        }
+
+        char result_storage[PBOX_RESULT_STORAGE];
+        callback_depth++;
+        cb->dispatch(cb->func_ptr, arg_storage, arg_offsets, result_storage);
+        callback_depth--;
+    }
+}
+
 // Dispatch a callback request from sandbox to host
 static void pbox_dispatch_callback(struct PBox* box, struct PBoxChannel* ch) {
+    // One-way callbacks made before this one run first
+    drain_oneway(box, ch);
+
     int id = ch->callback_id;
     if (id < 0 || id >= atomic_load(&box->callback_count))
         return;
@@ -556,36 +1437,105 @@ static void pbox_dispatch_callback(struct PBox* box, struct PBoxChannel* ch) {
         arg_offsets[i] = ch->args[i];
         if (arg_offsets[i] >= PBOX_ARG_STORAGE) {
             fprintf(stderr, "pbox: sandbox violated callback protocol\n");
-            kill(box->pid, SIGKILL);
+            kill_sandbox(box);
             return;
         }
     }
 
+    callback_depth++;
     cb->dispatch(cb->func_ptr, ch->arg_storage, arg_offsets,
                  ch->result_storage);
+    callback_depth--;
 }
 
-// Wait for response, handling callbacks from sandbox
-static void pbox_wait_for_response(struct PBox* box, struct PBoxChannel* ch) {
+// Wait for response, handling callbacks from sandbox. Returns -1 if the
+// sandbox died first.
+static int pbox_wait_for_response(struct PBox* box, struct PBoxChannel* ch) {
+    struct PBoxWaitPolicy policy = host_policy(box);
+    int state = atomic_load(&ch->state);
     while (1) {
-        int state = atomic_load(&ch->state);
-
         if (state == PBOX_STATE_RESPONSE)
-            return;
+            return 0;
 
         if (state == PBOX_STATE_CALLBACK) {
             pbox_dispatch_callback(box, ch);
-            pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-            continue;
+            state = PBOX_STATE_REQUEST;
+            host_set_state(box, ch, state);
         }
 
         if (state == PBOX_STATE_DEAD)
-            return;
+            return -1;
 
-        pbox_futex_wait(&ch->state, state);
+        state = pbox_wait_for_change(ch, PBOX_SIDE_HOST, policy, state);
     }
 }
 
+// Pack call arguments into storage, filling in their types and offsets
+static void pbox_pack_args(int nargs, const enum PBoxType* arg_types,
+                           void** args, int* types_out, uint64_t* offsets_out,
+                           char* storage, size_t storage_size) {
+    // nargs should be statically enforced by the C++ wrapper (static_assert).
+    assert(nargs <= PBOX_MAX_ARGS);
+
+    // Cannot overflow with current max types (8 * 8 = 64 bytes).
+    size_t offset = 0;
+    for (int i = 0; i < nargs; i++) {
+        size_t size = pbox_type_size(arg_types[i]);
+        assert(offset + size <= storage_size);
+        types_out[i] = arg_types[i];
+        offsets_out[i] = offset;
+        memcpy(&storage[offset], args[i], size);
+        offset += size;
+    }
+    (void) storage_size;
+}
+
+// Space an inline buffer takes in arg_storage
+static size_t inline_span(size_t size) {
+    return (size + 15) & ~(size_t) 15;
+}
+
+// Zero the results of a call that could not be made: ret, which can be
+// NULL, and the PBOX_INLINE_OUT buffers in inl
+static void zero_results(enum PBoxType ret_type, void* ret,
+                         const struct PBoxInlineArg* inl, int ninline) {
+    if (ret != NULL)
+        memset(ret, 0, pbox_type_size(ret_type));
+    for (int i = 0; i < ninline; i++) {
+        if (inl[i].flags & PBOX_INLINE_OUT)
+            memset(inl[i].data, 0, inl[i].size);
+    }
+}
+
+// Run the request set up on ch and store its result in ret, which can be
+// NULL, and the PBOX_INLINE_OUT buffers in inl, then give the channel back
+// (channel_return). Returns -1 if the sandbox died first, in which case the
+// results are zero rather than stale.
+static int call_finish(struct PBox* box, struct PBoxChannel* ch,
+                       enum PBoxType ret_type, void* ret,
+                       const struct PBoxInlineArg* inl, int ninline) {
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    if (pbox_wait_for_response(box, ch) < 0) {
+        zero_results(ret_type, ret, inl, ninline);
+        channel_return(box);
+        return -1;
+    }
+    atomic_store(&ch->state, PBOX_STATE_IDLE);
+
+    if (ret != NULL) {
+        memcpy(ret, ch->result_storage, pbox_type_size(ret_type));
+    }
+    size_t offset = PBOX_INLINE_BASE;
+    for (int i = 0; i < ninline; i++) {
+        if (inl[i].flags & PBOX_INLINE_OUT)
+            memcpy(inl[i].data, &ch->arg_storage[offset], inl[i].size);
+        offset += inline_span(inl[i].size);
+    }
+    drain_oneway(box, ch);
+    channel_return(box);
+    return 0;
+}
+
 void pbox_call(struct PBox* box, void* func_addr, enum PBoxType ret_type,
                int nargs, const enum PBoxType* arg_types, void** args,
                void* ret) {
@@ -593,152 +1543,513 @@ void pbox_call(struct PBox* box, void* func_addr, enum PBoxType ret_type,
     if (!ch)
         return;
 
-    // nargs should be statically enforced by the C++ wrapper (static_assert).
-    assert(nargs <= PBOX_MAX_ARGS);
+    _Static_assert(PBOX_MAX_ARGS * sizeof(uint64_t) <= PBOX_ARG_STORAGE,
+                   "arg_storage too small for max args");
+    ch->request_type = PBOX_REQ_CALL;
+    ch->func_addr = (uintptr_t) func_addr;
+    ch->nargs = nargs;
+    ch->ret_type = ret_type;
+    ch->inline_mask = 0;
+    pbox_pack_args(nargs, arg_types, args, ch->arg_types, ch->args,
+                   ch->arg_storage, PBOX_ARG_STORAGE);
+
+    call_finish(box, ch, ret_type, ret, NULL, 0);
+}
+
+int pbox_call_inline(struct PBox* box, void* func_addr, enum PBoxType ret_type,
+                     int nargs, const enum PBoxType* arg_types, void** args,
+                     const struct PBoxInlineArg* inl, int ninline, void* ret) {
+    _Static_assert(PBOX_INLINE_BASE + PBOX_INLINE_MAX <= PBOX_ARG_STORAGE,
+                   "arg_storage too small for inline buffers");
+
+    size_t total = 0;
+    for (int i = 0; i < ninline; i++) {
+        if (inl[i].index < 0 || inl[i].index >= nargs ||
+            arg_types[inl[i].index] != PBOX_TYPE_POINTER)
+            return -1;
+        total += inline_span(inl[i].size);
+    }
+    if (total > PBOX_INLINE_MAX)
+        return -1;
+
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch) {
+        zero_results(ret_type, ret, inl, ninline);
+        return -1;
+    }
 
     ch->request_type = PBOX_REQ_CALL;
     ch->func_addr = (uintptr_t) func_addr;
     ch->nargs = nargs;
     ch->ret_type = ret_type;
+    // The offsets are kept here too: the sandbox may rewrite ch->args
+    uint64_t offsets[PBOX_MAX_ARGS];
+    pbox_pack_args(nargs, arg_types, args, ch->arg_types, offsets,
+                   ch->arg_storage, PBOX_ARG_STORAGE);
+    memcpy(ch->args, offsets, nargs * sizeof(uint64_t));
+
+    // Each buffer's argument becomes its offset, for the sandbox to resolve
+    uint32_t mask = 0;
+    uint64_t offset = PBOX_INLINE_BASE;
+    for (int i = 0; i < ninline; i++) {
+        char* copy = &ch->arg_storage[offset];
+        if (inl[i].flags & PBOX_INLINE_IN)
+            memcpy(copy, inl[i].data, inl[i].size);
+        else
+            memset(copy, 0, inl[i].size);
+        uintptr_t value = offset;
+        memcpy(&ch->arg_storage[offsets[inl[i].index]], &value,
+               sizeof(value));
+        mask |= 1u << inl[i].index;
+        offset += inline_span(inl[i].size);
+    }
+    ch->inline_mask = mask;
 
-    // Pack arguments into arg_storage.
-    // Cannot overflow with current max types (8 * 8 = 64 bytes << 1024).
-    _Static_assert(PBOX_MAX_ARGS * sizeof(uint64_t) <= PBOX_ARG_STORAGE,
-                   "arg_storage too small for max args");
-    size_t offset = 0;
-    for (int i = 0; i < nargs; i++) {
-        size_t size = pbox_type_size(arg_types[i]);
-        assert(offset + size <= PBOX_ARG_STORAGE);
+    return call_finish(box, ch, ret_type, ret, inl, ninline);
+}
+
+// Find a described signature, or -1
+static int find_call_desc(struct PBox* box, enum PBoxType ret_type, int nargs,
+                          const enum PBoxType* arg_types) {
+    int count = atomic_load_explicit(&box->call_desc_count,
+                                     memory_order_acquire);
+    for (int i = 0; i < count; i++) {
+        const struct PBoxCallDesc* desc = &box->call_descs[i];
+        if (desc->ret_type == ret_type && desc->nargs == nargs &&
+            memcmp(desc->arg_types, arg_types,
+                   nargs * sizeof(enum PBoxType)) == 0)
+            return i;
+    }
+    return -1;
+}
+
+int pbox_describe_call(struct PBox* box, enum PBoxType ret_type, int nargs,
+                       const enum PBoxType* arg_types) {
+    // nargs should be statically enforced by the C++ wrapper (static_assert).
+    assert(nargs <= PBOX_MAX_ARGS);
+
+    int id = find_call_desc(box, ret_type, nargs, arg_types);
+    if (id >= 0)
+        return id;
+
+    // Take the channel before the lock, as register_callback does
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch)
+        return -1;
+
+    pthread_mutex_lock(&box->callback_lock);
+    id = find_call_desc(box, ret_type, nargs, arg_types);
+    if (id >= 0 ||
+        atomic_load(&box->call_desc_count) >= PBOX_MAX_CALL_DESCS) {
+        pthread_mutex_unlock(&box->callback_lock);
+        channel_return(box);
+        return id;
+    }
+
+    id = atomic_load(&box->call_desc_count);
+    struct PBoxCallDesc* desc = &box->call_descs[id];
+    desc->ret_type = ret_type;
+    desc->nargs = nargs;
+    for (int i = 0; i < nargs; i++)
+        desc->arg_types[i] = arg_types[i];
+
+    ch->request_type = PBOX_REQ_DESCRIBE;
+    ch->call_desc = id;
+    ch->ret_type = ret_type;
+    ch->nargs = nargs;
+    for (int i = 0; i < nargs; i++)
         ch->arg_types[i] = arg_types[i];
-        ch->args[i] = offset;
-        memcpy(&ch->arg_storage[offset], args[i], size);
-        offset += size;
+
+    // Only published once the sandbox has it, so that no call can use it
+    // before then
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    if (host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) == 0) {
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
+        if (ch->call_desc == id)
+            atomic_store_explicit(&box->call_desc_count, id + 1,
+                                  memory_order_release);
+        else
+            id = -1;
+    } else {
+        id = -1;
     }
 
-    pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_response(box, ch);
-    atomic_store(&ch->state, PBOX_STATE_IDLE);
+    pthread_mutex_unlock(&box->callback_lock);
+    channel_return(box);
+    return id;
+}
 
-    if (ret != NULL) {
-        memcpy(ret, ch->result_storage, pbox_type_size(ret_type));
+void pbox_call_desc(struct PBox* box, int desc, void* func_addr,
+                    const uint64_t* args, void* ret) {
+    assert(desc >= 0 && desc < atomic_load(&box->call_desc_count));
+    const struct PBoxCallDesc* d = &box->call_descs[desc];
+
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch)
+        return;
+
+    ch->request_type = PBOX_REQ_CALL_DESC;
+    ch->call_desc = desc;
+    ch->func_addr = (uintptr_t) func_addr;
+    if (d->nargs > 0)
+        memcpy(ch->arg_storage, args, d->nargs * sizeof(uint64_t));
+
+    call_finish(box, ch, d->ret_type, ret, NULL, 0);
+}
+
+// Number of ring slots submitted but not yet run. A count above the ring size
+// can only come from a misbehaving sandbox, which is killed.
+static unsigned ring_pending(struct PBox* box, struct PBoxChannel* ch) {
+    unsigned head = atomic_load_explicit(&ch->ring_head, memory_order_relaxed);
+    unsigned done = atomic_load_explicit(&ch->ring_done, memory_order_acquire);
+    unsigned pending = head - done;
+    if (pending > PBOX_RING_SLOTS) {
+        fprintf(stderr, "pbox: sandbox violated call ring protocol\n");
+        kill_sandbox(box);
+        return PBOX_RING_SLOTS;
     }
+    return pending;
 }
 
-// Internal: actually send an fd without checking cache
-static int pbox_send_fd_on_channel(struct PBox* box, struct PBoxChannel* ch,
-                                   int fd) {
-    // Send fd over socket using SCM_RIGHTS
+// Has token (issued on this thread channel) finished running?
+static int ring_token_done(struct PBox* box, struct PBoxThreadChannel* tch,
+                           uint64_t token) {
+    return token <= tch->ring_seq - ring_pending(box, tch->channel);
+}
+
+// Ask the sandbox worker to drain the ring if it is not already doing so
+static void ring_kick(struct PBox* box, struct PBoxChannel* ch, int state) {
+    if (state != PBOX_STATE_IDLE && state != PBOX_STATE_RESPONSE)
+        return;
+    ch->request_type = PBOX_REQ_RING;
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+}
+
+// Drive the ring until token has run, dispatching any callbacks the ring
+// makes. If block is zero, returns as soon as it would have to wait.
+// Returns 1 if the token has run, 0 if not yet, -1 if the sandbox is dead.
+static int ring_progress(struct PBox* box, struct PBoxThreadChannel* tch,
+                         uint64_t token, int block) {
+    struct PBoxChannel* ch = tch->channel;
+    struct PBoxWaitPolicy policy = host_policy(box);
+    int state = atomic_load(&ch->state);
+    while (1) {
+        if (state == PBOX_STATE_CALLBACK) {
+            pbox_dispatch_callback(box, ch);
+            state = PBOX_STATE_REQUEST;
+            host_set_state(box, ch, state);
+        }
+
+        if (ring_token_done(box, tch, token)) {
+            // One-way callbacks can run once the worker has stopped
+            state = atomic_load(&ch->state);
+            if (state == PBOX_STATE_IDLE || state == PBOX_STATE_RESPONSE)
+                drain_oneway(box, ch);
+            return 1;
+        }
+        if (state == PBOX_STATE_DEAD)
+            return -1;
+
+        // The worker finished a drain before seeing our latest slot.
+        if (state == PBOX_STATE_IDLE || state == PBOX_STATE_RESPONSE) {
+            ring_kick(box, ch, state);
+            state = PBOX_STATE_REQUEST;
+        }
+
+        if (!block)
+            return 0;
+        state = pbox_wait_for_change(ch, PBOX_SIDE_HOST, policy, state);
+    }
+}
+
+// Complete every ring call in flight and leave the channel idle, so that its
+// mailbox can be used for a synchronous request.
+static void ring_quiesce(struct PBox* box, struct PBoxThreadChannel* tch) {
+    // Inside a callback the channel is busy with the call that made it.
+    if (tch->ring_seq == 0 || callback_depth)
+        return;
+    if (ring_progress(box, tch, tch->ring_seq, 1) < 0)
+        return;
+
+    // Wait out the drain request itself.
+    struct PBoxChannel* ch = tch->channel;
+    int state = atomic_load(&ch->state);
+    if (state == PBOX_STATE_REQUEST || state == PBOX_STATE_CALLBACK) {
+        pbox_wait_for_response(box, ch);
+        state = atomic_load(&ch->state);
+    }
+    if (state == PBOX_STATE_RESPONSE)
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
+    drain_oneway(box, ch);
+}
+
+// Look up the ring slot holding an unclaimed token, or -1
+static int ring_slot_of(struct PBoxThreadChannel* tch, pbox_token_t token) {
+    if (token == 0 || token > tch->ring_seq)
+        return -1;
+    int slot = (int) ((token - 1) % PBOX_RING_SLOTS);
+    return tch->slot_token[slot] == token ? slot : -1;
+}
+
+// Queue a call in the next ring slot, waiting for the oldest slot to run if
+// the ring is full. The worker is only woken if kick is set. Returns the
+// call's token, or 0 if the sandbox died.
+static pbox_token_t ring_submit(struct PBox* box,
+                                struct PBoxThreadChannel* tch,
+                                void* func_addr, enum PBoxType ret_type,
+                                int nargs, const enum PBoxType* arg_types,
+                                void** args, int kick) {
+    struct PBoxChannel* ch = tch->channel;
+
+    if (ring_pending(box, ch) == PBOX_RING_SLOTS &&
+        ring_progress(box, tch, tch->ring_seq - PBOX_RING_SLOTS + 1, 1) < 0)
+        return 0;
+
+    pbox_token_t token = tch->ring_seq + 1;
+    int index = (int) ((token - 1) % PBOX_RING_SLOTS);
+    struct PBoxCallSlot* slot = &ch->ring[index];
+    slot->func_addr = (uintptr_t) func_addr;
+    slot->nargs = nargs;
+    slot->ret_type = ret_type;
+    pbox_pack_args(nargs, arg_types, args, slot->arg_types, slot->args,
+                   slot->arg_storage, PBOX_SLOT_ARG_STORAGE);
+
+    tch->ring_seq = token;
+    tch->slot_token[index] = token;
+    atomic_store_explicit(&ch->ring_head, (unsigned) token,
+                          memory_order_seq_cst);
+    if (kick)
+        ring_kick(box, ch, atomic_load(&ch->state));
+    return token;
+}
+
+pbox_token_t pbox_call_async(struct PBox* box, void* func_addr,
+                             enum PBoxType ret_type, int nargs,
+                             const enum PBoxType* arg_types, void** args) {
+    struct PBoxThreadChannel* tch = get_or_create_thread_channel(box);
+    if (!tch)
+        return 0;
+    pbox_token_t token = ring_submit(box, tch, func_addr, ret_type, nargs,
+                                     arg_types, args, 1);
+    channel_return(box);  // Kept by a shared-channel thread until claimed
+    return token;
+}
+
+int pbox_call_batch(struct PBox* box, const struct PBoxBatchCall* calls,
+                    int ncalls) {
+    struct PBoxThreadChannel* tch = get_or_create_thread_channel(box);
+    if (!tch)
+        return -1;
+    struct PBoxChannel* ch = tch->channel;
+
+    // Fill up to a ring's worth of slots before waking the worker, so each
+    // chunk costs a single round trip.
+    for (int start = 0; start < ncalls; start += PBOX_RING_SLOTS) {
+        int end = start + PBOX_RING_SLOTS;
+        if (end > ncalls)
+            end = ncalls;
+
+        pbox_token_t first = 0, last = 0;
+        for (int i = start; i < end; i++) {
+            const struct PBoxBatchCall* c = &calls[i];
+            last = ring_submit(box, tch, c->func_addr, c->ret_type, c->nargs,
+                               c->arg_types, c->args, 0);
+            if (last == 0) {
+                channel_return(box);
+                return -1;
+            }
+            if (!first)
+                first = last;
+            // Batch results are not claimable through pbox_wait.
+            tch->slot_token[(last - 1) % PBOX_RING_SLOTS] = 0;
+        }
+
+        ring_kick(box, ch, atomic_load(&ch->state));
+        if (ring_progress(box, tch, last, 1) < 0) {
+            channel_return(box);
+            return -1;
+        }
+
+        for (int i = start; i < end; i++) {
+            const struct PBoxBatchCall* c = &calls[i];
+            pbox_token_t token = first + (pbox_token_t) (i - start);
+            struct PBoxCallSlot* slot =
+                &ch->ring[(token - 1) % PBOX_RING_SLOTS];
+            if (c->ret != NULL)
+                memcpy(c->ret, slot->result_storage,
+                       pbox_type_size(c->ret_type));
+        }
+    }
+    channel_return(box);
+    return 0;
+}
+
+int pbox_poll(struct PBox* box, pbox_token_t token) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (!tch || ring_slot_of(tch, token) < 0)
+        return -1;
+
+    return ring_progress(box, tch, token, 0);
+}
+
+int pbox_wait(struct PBox* box, pbox_token_t token, void* ret) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (!tch)
+        return -1;
+    int index = ring_slot_of(tch, token);
+    if (index < 0)
+        return -1;
+
+    if (ring_progress(box, tch, token, 1) < 0)
+        return -1;
+
+    tch->slot_token[index] = 0;
+    struct PBoxCallSlot* slot = &tch->channel->ring[index];
+    if (ret != NULL)
+        memcpy(ret, slot->result_storage,
+               pbox_type_size((enum PBoxType) slot->ret_type));
+    channel_release_idle(box, tch);
+    return 0;
+}
+
+// Internal: send fds in one message without checking the cache (must hold
+// fd_lock). Returns 0 on success, -1 on error.
+static int send_fds_on_channel(struct PBox* box, struct PBoxChannel* ch,
+                               const int* fds, size_t count,
+                               int* sandbox_fds) {
+    // Send fds over socket using SCM_RIGHTS
     struct msghdr msg = {0};
     struct iovec iov;
     char buf[1] = {0};
-    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+    union {
+        char buf[CMSG_SPACE(PBOX_RECV_FDS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } cmsg_buf;
 
     iov.iov_base = buf;
     iov.iov_len = sizeof(buf);
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
-    msg.msg_control = cmsg_buf;
-    msg.msg_controllen = sizeof(cmsg_buf);
+    msg.msg_control = cmsg_buf.buf;
+    msg.msg_controllen = CMSG_SPACE(count * sizeof(int));
 
     struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
     cmsg->cmsg_level = SOL_SOCKET;
     cmsg->cmsg_type = SCM_RIGHTS;
-    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
-    memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), fds, count * sizeof(int));
 
-    if (sendmsg(box->sock_fd, &msg, 0) < 0)
+    if (sendmsg(box->sock_fd, &msg, MSG_NOSIGNAL) < 0)
         return -1;
 
-    // Signal sandbox to receive the fd
+    // Signal sandbox to receive the fds
     ch->request_type = PBOX_REQ_RECV_FD;
-    pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_state(&ch->state, PBOX_STATE_RESPONSE);
-    atomic_store(&ch->state, PBOX_STATE_IDLE);
-
-    return ch->received_fd;
-}
-
-// Internal: add fd mapping to cache
-static void pbox_cache_fd(struct PBox* box, int host_fd, int sandbox_fd) {
-    if (host_fd < PBOX_FD_DIRECT_MAX) {
-        box->fd_direct[host_fd] = sandbox_fd;
-        return;
+    ch->fd_count = (int) count;
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    if (ch == box->control_channel) {
+        if (control_await_response(box) < 0)
+            return -1;
+    } else {
+        if (host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) < 0)
+            return -1;
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
     }
 
-    // Grow overflow vector if needed
-    if (box->fd_overflow_count >= box->fd_overflow_cap) {
-        size_t new_cap = box->fd_overflow_cap ? box->fd_overflow_cap * 2 : 8;
-        struct PBoxFdEntry* new_vec =
-            realloc(box->fd_overflow, new_cap * sizeof(struct PBoxFdEntry));
-        if (!new_vec)
-            return;  // Can't cache, but not fatal
-        box->fd_overflow = new_vec;
-        box->fd_overflow_cap = new_cap;
-    }
+    if (ch->fd_count != (int) count)
+        return -1;
+    memcpy(sandbox_fds, ch->arg_storage, count * sizeof(int));
 
-    box->fd_overflow[box->fd_overflow_count].host_fd = host_fd;
-    box->fd_overflow[box->fd_overflow_count].sandbox_fd = sandbox_fd;
-    box->fd_overflow_count++;
+    // The numbers come from the sandbox, so don't trust them
+    for (size_t i = 0; i < count; i++) {
+        if (sandbox_fds[i] < 0)
+            return -1;
+    }
+    return 0;
 }
 
-// Internal: lookup fd in cache, returns -1 if not found
-static int pbox_lookup_fd(struct PBox* box, int host_fd) {
-    if (host_fd < PBOX_FD_DIRECT_MAX)
-        return box->fd_direct[host_fd];
+// Internal: send one fd without checking or updating the cache
+static int pbox_send_fd_on_channel(struct PBox* box, struct PBoxChannel* ch,
+                                   int fd) {
+    int sandbox_fd;
+    pthread_mutex_lock(&box->fd_lock);
+    int result = send_fds_on_channel(box, ch, &fd, 1, &sandbox_fd);
+    pthread_mutex_unlock(&box->fd_lock);
+    return result < 0 ? -1 : sandbox_fd;
+}
 
-    for (size_t i = 0; i < box->fd_overflow_count; i++) {
-        if (box->fd_overflow[i].host_fd == host_fd)
-            return box->fd_overflow[i].sandbox_fd;
+static long find_fd(const int* fds, size_t count, int fd) {
+    for (size_t i = 0; i < count; i++) {
+        if (fds[i] == fd)
+            return (long) i;
     }
     return -1;
 }
 
-int pbox_send_fd(struct PBox* box, int fd) {
-    if (fd < 0)
-        return fd;
-
-    pthread_mutex_lock(&box->fd_lock);
-
-    // Return cached sandbox fd if already sent
-    int cached = pbox_lookup_fd(box, fd);
-    if (cached >= 0) {
-        pthread_mutex_unlock(&box->fd_lock);
-        return cached;
+int pbox_send_fds(struct PBox* box, const int* fds, size_t count,
+                  int* sandbox_fds) {
+    // Translate the fds sent before without touching the channel
+    size_t missing = 0;
+    for (size_t i = 0; i < count; i++) {
+        sandbox_fds[i] =
+            fds[i] < 0 ? fds[i] : pbox_fdmap_lookup(&box->fds, fds[i]);
+        if (sandbox_fds[i] < 0 && fds[i] >= 0)
+            missing++;
     }
+    if (missing == 0)
+        return 0;
 
-    // Get thread-local channel
+    // Get thread-local channel. A shared channel may take a while to come
+    // free, so don't hold the lock while waiting for one.
     struct PBoxChannel* ch = get_or_create_channel(box);
-    if (!ch) {
-        pthread_mutex_unlock(&box->fd_lock);
+    if (!ch)
         return -1;
-    }
-
-    // Send and cache
-    int sandbox_fd = pbox_send_fd_on_channel(box, ch, fd);
-    if (sandbox_fd >= 0)
-        pbox_cache_fd(box, fd, sandbox_fd);
-
-    pthread_mutex_unlock(&box->fd_lock);
-    return sandbox_fd;
-}
+    pthread_mutex_lock(&box->fd_lock);
 
-// Invalidate fd cache entry for a sandbox fd
-static void pbox_uncache_fd(struct PBox* box, int sandbox_fd) {
-    // Check direct table
-    for (int i = 0; i < PBOX_FD_DIRECT_MAX; i++) {
-        if (box->fd_direct[i] == sandbox_fd) {
-            box->fd_direct[i] = -1;
-            return;
+    int result = 0;
+    size_t i = 0;
+    while (i < count && result == 0) {
+        // Fill a message with fds not yet sent, by us or by another thread
+        // meanwhile. An fd listed twice is sent once.
+        int batch[PBOX_RECV_FDS_MAX];
+        int sent[PBOX_RECV_FDS_MAX];
+        size_t start = i, n = 0;
+        for (; i < count && n < PBOX_RECV_FDS_MAX; i++) {
+            if (fds[i] < 0 || sandbox_fds[i] >= 0 ||
+                find_fd(batch, n, fds[i]) >= 0 ||
+                pbox_fdmap_lookup(&box->fds, fds[i]) >= 0)
+                continue;
+            batch[n++] = fds[i];
+        }
+        if (n > 0 && send_fds_on_channel(box, ch, batch, n, sent) < 0) {
+            result = -1;
+            break;
         }
-    }
 
-    // Check overflow table
-    for (size_t i = 0; i < box->fd_overflow_count; i++) {
-        if (box->fd_overflow[i].sandbox_fd == sandbox_fd) {
-            box->fd_overflow[i] = box->fd_overflow[--box->fd_overflow_count];
-            return;
+        // Not caching one is not fatal: it is sent again next time
+        for (size_t j = 0; j < n; j++)
+            pbox_fdmap_insert(&box->fds, batch[j], sent[j]);
+
+        for (size_t k = start; k < i; k++) {
+            if (fds[k] < 0 || sandbox_fds[k] >= 0)
+                continue;
+            long j = find_fd(batch, n, fds[k]);
+            sandbox_fds[k] =
+                j >= 0 ? sent[j] : pbox_fdmap_lookup(&box->fds, fds[k]);
+            if (sandbox_fds[k] < 0)
+                result = -1;
         }
     }
+
+    pthread_mutex_unlock(&box->fd_lock);
+    channel_return(box);
+    return result;
+}
+
+int pbox_send_fd(struct PBox* box, int fd) {
+    int sandbox_fd;
+    if (pbox_send_fds(box, &fd, 1, &sandbox_fd) < 0)
+        return -1;
+    return sandbox_fd;
 }
 
 int pbox_close(struct PBox* box, int sandbox_fd) {
@@ -752,23 +2063,27 @@ int pbox_close(struct PBox* box, int sandbox_fd) {
               &result);
 
     // Invalidate cache entry
-    if (result == 0) {
-        pthread_mutex_lock(&box->fd_lock);
-        pbox_uncache_fd(box, sandbox_fd);
-        pthread_mutex_unlock(&box->fd_lock);
-    }
+    if (result == 0)
+        pbox_fdmap_remove(&box->fds, sandbox_fd);
 
     return result;
 }
 
-void* pbox_register_callback(struct PBox* box, pbox_fn_t host_func,
-                             pbox_callback_dispatch_fn dispatch,
-                             enum PBoxType ret_type, int nargs,
-                             const enum PBoxType* arg_types) {
+static void* register_callback(struct PBox* box, pbox_fn_t host_func,
+                               pbox_callback_dispatch_fn dispatch,
+                               enum PBoxType ret_type, int nargs,
+                               const enum PBoxType* arg_types, int oneway) {
+    // Take the channel first: waiting for a shared one while holding the
+    // lock would block threads registering callbacks from callbacks.
+    struct PBoxChannel* ch = get_or_create_channel(box);
+    if (!ch)
+        return NULL;
+
     pthread_mutex_lock(&box->callback_lock);
 
     if (atomic_load(&box->callback_count) >= PBOX_MAX_CALLBACKS) {
         pthread_mutex_unlock(&box->callback_lock);
+        channel_return(box);
         return NULL;
     }
 
@@ -784,6 +2099,7 @@ void* pbox_register_callback(struct PBox* box, pbox_fn_t host_func,
     cb->dispatch = dispatch;
     cb->ret_type = ret_type;
     cb->nargs = nargs;
+    cb->oneway = oneway;
     for (int i = 0; i < nargs && i < PBOX_MAX_ARGS; i++)
         cb->arg_types[i] = arg_types[i];
 
@@ -791,31 +2107,43 @@ void* pbox_register_callback(struct PBox* box, pbox_fn_t host_func,
     atomic_store(&box->callback_count, id + 1);
 
     // Request sandbox to create closure
-    struct PBoxChannel* ch = get_or_create_channel(box);
-    if (!ch) {
-        atomic_store(&box->callback_count, id);
-        pthread_mutex_unlock(&box->callback_lock);
-        return NULL;
-    }
-
     ch->request_type = PBOX_REQ_CREATE_CLOSURE;
     ch->closure_callback_id = id;
     ch->closure_ret_type = ret_type;
     ch->closure_nargs = nargs;
+    ch->closure_oneway = oneway;
     for (int i = 0; i < nargs && i < PBOX_MAX_ARGS; i++)
         ch->closure_arg_types[i] = arg_types[i];
 
-    pbox_set_state(&ch->state, PBOX_STATE_REQUEST);
-    pbox_wait_for_state(&ch->state, PBOX_STATE_RESPONSE);
-
-    void* closure_addr = (void*) ch->closure_addr;
+    host_set_state(box, ch, PBOX_STATE_REQUEST);
+    void* closure_addr = NULL;
+    if (host_wait_for_state(box, ch, PBOX_STATE_RESPONSE) == 0) {
+        closure_addr = (void*) ch->closure_addr;
+        atomic_store(&ch->state, PBOX_STATE_IDLE);
+    }
     cb->sandbox_closure = closure_addr;
 
-    atomic_store(&ch->state, PBOX_STATE_IDLE);
     pthread_mutex_unlock(&box->callback_lock);
+    channel_return(box);
     return closure_addr;
 }
 
+void* pbox_register_callback(struct PBox* box, pbox_fn_t host_func,
+                             pbox_callback_dispatch_fn dispatch,
+                             enum PBoxType ret_type, int nargs,
+                             const enum PBoxType* arg_types) {
+    return register_callback(box, host_func, dispatch, ret_type, nargs,
+                             arg_types, 0);
+}
+
+void* pbox_register_oneway_callback(struct PBox* box, pbox_fn_t host_func,
+                                    pbox_callback_dispatch_fn dispatch,
+                                    int nargs,
+                                    const enum PBoxType* arg_types) {
+    return register_callback(box, host_func, dispatch, PBOX_TYPE_VOID, nargs,
+                             arg_types, 1);
+}
+
 void* pbox_mmap_box_fd(struct PBox* box, void* addr, size_t length, int prot,
                        int flags, int sandbox_fd, off_t offset) {
     if (!box->sym_mmap)
@@ -853,39 +2181,84 @@ int pbox_munmap(struct PBox* box, void* addr, size_t length) {
     return result;
 }
 
-void* pbox_mmap_identity(struct PBox* box, size_t length, int prot) {
-    if (!box->sym_mmap)
-        return NULL;
+// Call a function in the sandbox on the control channel (must hold
+// channel_lock). Only for functions that make no callbacks. The result is
+// zero if the sandbox died.
+static void control_call(struct PBox* box, void* func_addr,
+                         enum PBoxType ret_type, int nargs,
+                         const enum PBoxType* arg_types, void** args,
+                         void* ret) {
+    struct PBoxChannel* ctrl = box->control_channel;
+    ctrl->request_type = PBOX_REQ_CALL;
+    ctrl->func_addr = (uintptr_t) func_addr;
+    ctrl->nargs = nargs;
+    ctrl->ret_type = ret_type;
+    ctrl->inline_mask = 0;
+    pbox_pack_args(nargs, arg_types, args, ctrl->arg_types, ctrl->args,
+                   ctrl->arg_storage, PBOX_ARG_STORAGE);
+
+    host_set_state(box, ctrl, PBOX_STATE_REQUEST);
+    if (control_await_response(box) < 0)
+        memset(ret, 0, pbox_type_size(ret_type));
+    else
+        memcpy(ret, ctrl->result_storage, pbox_type_size(ret_type));
+}
 
-    // Create anonymous shared memory
-    int memfd = memfd_create("pbox_shared", MFD_CLOEXEC);
-    if (memfd < 0)
-        return NULL;
+// As pbox_call, or control_call if control is set. The control channel
+// lets pbox_create set up shared memory without starting a worker for the
+// creating thread.
+static void identity_call(struct PBox* box, int control, void* func_addr,
+                          enum PBoxType ret_type, int nargs,
+                          const enum PBoxType* arg_types, void** args,
+                          void* ret) {
+    if (!control) {
+        pbox_call(box, func_addr, ret_type, nargs, arg_types, args, ret);
+        return;
+    }
+    pthread_mutex_lock(&box->channel_lock);
+    control_call(box, func_addr, ret_type, nargs, arg_types, args, ret);
+    pthread_mutex_unlock(&box->channel_lock);
+}
 
-    if (ftruncate(memfd, length) < 0) {
-        close(memfd);
+static void identity_unmap_sandbox(struct PBox* box, int control, void* addr,
+                                   size_t length) {
+    int result;
+    enum PBoxType arg_types[] = {PBOX_TYPE_POINTER, PBOX_TYPE_UINT64};
+    void* args[] = {&addr, &length};
+    identity_call(box, control, box->sym_munmap, PBOX_TYPE_SINT32, 2,
+                  arg_types, args, &result);
+}
+
+// Map memfd at the same address in the host and the sandbox, talking to
+// the sandbox on the control channel if control is set (see
+// identity_call). The caller keeps ownership of memfd.
+static void* identity_map_fd(struct PBox* box, int memfd, size_t length,
+                             int prot, int control) {
+    if (!box->sym_mmap || !box->sym_munmap)
         return NULL;
-    }
 
     // Map in host - let kernel pick address
     void* host_addr = mmap(NULL, length, prot, MAP_SHARED, memfd, 0);
-    if (host_addr == MAP_FAILED) {
-        close(memfd);
+    if (host_addr == MAP_FAILED)
         return NULL;
-    }
 
     // Send fd to sandbox without caching -- this memfd is temporary and
     // will be closed after mapping, so caching would leave a stale entry.
-    struct PBoxChannel* ch = get_or_create_channel(box);
-    if (!ch) {
-        munmap(host_addr, length);
-        close(memfd);
-        return NULL;
+    int sandbox_fd = -1;
+    if (control) {
+        pthread_mutex_lock(&box->channel_lock);
+        sandbox_fd =
+            pbox_send_fd_on_channel(box, box->control_channel, memfd);
+        pthread_mutex_unlock(&box->channel_lock);
+    } else {
+        struct PBoxChannel* ch = get_or_create_channel(box);
+        if (ch) {
+            sandbox_fd = pbox_send_fd_on_channel(box, ch, memfd);
+            channel_return(box);
+        }
     }
-    int sandbox_fd = pbox_send_fd_on_channel(box, ch, memfd);
     if (sandbox_fd < 0) {
         munmap(host_addr, length);
-        close(memfd);
         return NULL;
     }
 
@@ -897,25 +2270,21 @@ void* pbox_mmap_identity(struct PBox* box, size_t length, int prot) {
                                  PBOX_TYPE_SINT32,  PBOX_TYPE_SINT32,
                                  PBOX_TYPE_SINT32,  PBOX_TYPE_SINT64};
     void* args[] = {&host_addr, &length, &prot, &flags, &sandbox_fd, &offset};
-    pbox_call(box, box->sym_mmap, PBOX_TYPE_POINTER, 6, arg_types, args,
-              &sandbox_addr);
+    identity_call(box, control, box->sym_mmap, PBOX_TYPE_POINTER, 6,
+                  arg_types, args, &sandbox_addr);
 
-    if (sandbox_addr == host_addr) {
-        close(memfd);
+    if (sandbox_addr == host_addr)
         return host_addr;
-    }
 
     // First attempt failed - fallback to /proc/maps
-    if (sandbox_addr != MAP_FAILED)
-        pbox_munmap(box, sandbox_addr, length);
+    if (sandbox_addr != MAP_FAILED && sandbox_addr != NULL)
+        identity_unmap_sandbox(box, control, sandbox_addr, length);
     munmap(host_addr, length);
 
     void* common_addr =
         pbox_find_common_free_address(getpid(), box->pid, length);
-    if (!common_addr) {
-        close(memfd);
+    if (!common_addr)
         return NULL;
-    }
 
     // Map in host at chosen address
     host_addr = mmap(common_addr, length, prot,
@@ -923,34 +2292,191 @@ void* pbox_mmap_identity(struct PBox* box, size_t length, int prot) {
     if (host_addr != common_addr) {
         if (host_addr != MAP_FAILED)
             munmap(host_addr, length);
-        close(memfd);
         return NULL;
     }
 
     // Map in sandbox at same address
     args[0] = &common_addr;
-    pbox_call(box, box->sym_mmap, PBOX_TYPE_POINTER, 6, arg_types, args,
-              &sandbox_addr);
+    identity_call(box, control, box->sym_mmap, PBOX_TYPE_POINTER, 6,
+                  arg_types, args, &sandbox_addr);
 
     if (sandbox_addr != common_addr) {
-        if (sandbox_addr != MAP_FAILED)
-            pbox_munmap(box, sandbox_addr, length);
+        if (sandbox_addr != MAP_FAILED && sandbox_addr != NULL)
+            identity_unmap_sandbox(box, control, sandbox_addr, length);
         munmap(host_addr, length);
+        return NULL;
+    }
+
+    return common_addr;
+}
+
+// Reserve the identity window in both processes
+static void setup_window(struct PBox* box, size_t size) {
+    if (!box->sym_mprotect)
+        return;
+    int memfd = memfd_create("pbox_window", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0)
+        return;
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size = (size + page - 1) & ~(page - 1);
+
+    // As with the heap, the sandbox must not shrink the file from under us
+    if (ftruncate(memfd, (off_t) size) < 0 ||
+        fcntl(memfd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(memfd);
+        return;
+    }
+
+    void* base = identity_map_fd(box, memfd, size, PROT_NONE, 1);
+    if (!base) {
         close(memfd);
+        return;
+    }
+    if (pbox_window_attach(&box->window, base, size, memfd) < 0) {
+        identity_unmap_sandbox(box, 1, base, size);
+        munmap(base, size);
+        close(memfd);
+    }
+}
+
+// Change the protection of window memory in the sandbox, on the control
+// channel if control is set (see identity_call)
+static int sandbox_mprotect(struct PBox* box, void* addr, size_t length,
+                            int prot, int control) {
+    int result = -1;
+    enum PBoxType arg_types[] = {PBOX_TYPE_POINTER, PBOX_TYPE_UINT64,
+                                 PBOX_TYPE_SINT32};
+    void* args[] = {&addr, &length, &prot};
+    identity_call(box, control, box->sym_mprotect, PBOX_TYPE_SINT32, 3,
+                  arg_types, args, &result);
+    return result == 0 && pbox_alive(box) ? 0 : -1;
+}
+
+// Carve an identity mapping from the window. Returns NULL if it is full.
+static void* window_map(struct PBox* box, size_t length, int prot) {
+    void* addr = pbox_window_alloc(&box->window, length, prot);
+    if (!addr)
+        return NULL;
+    if (sandbox_mprotect(box, addr, length, prot, 0) < 0) {
+        pbox_window_free(&box->window, addr, length);
         return NULL;
     }
+    return addr;
+}
 
+// Give back identity memory of a channel that can no longer make calls,
+// such as an exiting thread's. A window block is made PROT_NONE in the
+// sandbox over the control channel before it can be handed out again, and
+// is kept out of the window if that fails, since the sandbox could still
+// write to it. Other mappings are only unmapped on the host side and stay
+// in the sandbox until it exits.
+static void identity_release_orphan(struct PBox* box, void* addr,
+                                    size_t length) {
+    if (!pbox_window_contains(&box->window, addr)) {
+        munmap(addr, length);
+        return;
+    }
+    // pbox_destroy holds channel_lock, and takes the whole window down
+    if (atomic_load(&box->destroying))
+        return;
+    if (sandbox_mprotect(box, addr, length, PROT_NONE, 1) == 0)
+        pbox_window_free(&box->window, addr, length);
+}
+
+void* pbox_mmap_identity(struct PBox* box, size_t length, int prot) {
+    void* addr = window_map(box, length, prot);
+    if (!addr) {
+        // No window, or no room left in it: map on its own
+        int memfd = memfd_create("pbox_shared", MFD_CLOEXEC);
+        if (memfd < 0)
+            return NULL;
+
+        if (ftruncate(memfd, length) < 0) {
+            close(memfd);
+            return NULL;
+        }
+
+        addr = identity_map_fd(box, memfd, length, prot, 0);
+        close(memfd);
+        if (!addr)
+            return NULL;
+    }
+
+    if (pbox_index_insert(&box->regions, addr, length) < 0) {
+        pbox_munmap_identity(box, addr, length);
+        return NULL;
+    }
+    return addr;
+}
+
+// Create the shared heap and have the sandbox's malloc serve from it
+static void setup_shared_heap(struct PBox* box) {
+    int memfd = memfd_create("pbox_heap", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (memfd < 0)
+        return;
+
+    // The host accesses heap objects directly, so the sandbox must not be
+    // able to shrink the file from under it.
+    if (ftruncate(memfd, PBOX_HEAP_SIZE) < 0 ||
+        fcntl(memfd, F_ADD_SEALS,
+              F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+        close(memfd);
+        return;
+    }
+
+    void* base = identity_map_fd(box, memfd, PBOX_HEAP_SIZE,
+                                 PROT_READ | PROT_WRITE, 1);
     close(memfd);
-    return common_addr;
+    if (!base)
+        return;
+    pbox_heap_format(base, PBOX_HEAP_SIZE);
+
+    pthread_mutex_lock(&box->channel_lock);
+    struct PBoxChannel* ctrl = box->control_channel;
+    ctrl->request_type = PBOX_REQ_HEAP_INIT;
+    ctrl->heap_base = (uintptr_t) base;
+    ctrl->heap_size = PBOX_HEAP_SIZE;
+    host_set_state(box, ctrl, PBOX_STATE_REQUEST);
+    int dead = control_await_response(box) < 0;
+    pthread_mutex_unlock(&box->channel_lock);
+    if (dead) {
+        munmap(base, PBOX_HEAP_SIZE);
+        return;
+    }
+
+    box->heap.base = base;
+    box->heap.size = PBOX_HEAP_SIZE;
 }
 
 int pbox_munmap_identity(struct PBox* box, void* addr, size_t length) {
+    // Window blocks are only given back whole
+    if (pbox_window_contains(&box->window, addr) &&
+        !pbox_window_owns(&box->window, addr, length)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Stop verifying pointers into the region before it goes away
+    pbox_index_remove(&box->regions, addr, length);
+    if (pbox_window_contains(&box->window, addr)) {
+        // Back to PROT_NONE, so the range stays reserved on both sides
+        int sandbox_result =
+            sandbox_mprotect(box, addr, length, PROT_NONE, 0);
+        pbox_window_free(&box->window, addr, length);
+        return sandbox_result;
+    }
     int sandbox_result = pbox_munmap(box, addr, length);
     int host_result = munmap(addr, length);
     return (sandbox_result == 0 && host_result == 0) ? 0 : -1;
 }
 
 void* pbox_malloc(struct PBox* box, size_t size) {
+    void* p = pbox_heap_alloc(&box->heap, size, 1);
+    if (p)
+        return p;
+
     if (!box->sym_malloc)
         return NULL;
 
@@ -963,6 +2489,15 @@ void* pbox_malloc(struct PBox* box, size_t size) {
 }
 
 void* pbox_calloc(struct PBox* box, size_t nmemb, size_t size) {
+    size_t total;
+    if (!__builtin_mul_overflow(nmemb, size, &total)) {
+        void* p = pbox_heap_alloc(&box->heap, total, 1);
+        if (p) {
+            memset(p, 0, total);
+            return p;
+        }
+    }
+
     if (!box->sym_calloc)
         return NULL;
 
@@ -975,6 +2510,21 @@ void* pbox_calloc(struct PBox* box, size_t nmemb, size_t size) {
 }
 
 void* pbox_realloc(struct PBox* box, void* p, size_t size) {
+    if (!p)
+        return pbox_malloc(box, size);
+
+    size_t usable = pbox_heap_usable_size(&box->heap, p);
+    if (usable && size <= usable)
+        return p;
+    if (usable) {
+        void* q = pbox_malloc(box, size);
+        if (!q)
+            return NULL;
+        pbox_copy_to(box, q, p, usable);
+        pbox_free(box, p);
+        return q;
+    }
+
     if (!box->sym_realloc)
         return NULL;
 
@@ -987,6 +2537,10 @@ void* pbox_realloc(struct PBox* box, void* p, size_t size) {
 }
 
 void pbox_free(struct PBox* box, void* p) {
+    if (pbox_heap_contains(&box->heap, p, 1) &&
+        pbox_heap_free(&box->heap, p, 1) == 0)
+        return;
+
     if (!box->sym_free)
         return;
 
@@ -995,7 +2549,67 @@ void pbox_free(struct PBox* box, void* p) {
     pbox_call(box, box->sym_free, PBOX_TYPE_VOID, 1, arg_types, args, NULL);
 }
 
-void pbox_copy_to(struct PBox* box, void* dest, const void* src, size_t n) {
+// Copy regions between host and sandbox memory with process_vm_writev (to
+// the sandbox) or process_vm_readv. Returns 0 on success, -1 if the kernel
+// does not let us access the sandbox this way (the caller should copy through
+// the channel instead), or -2 if the copy failed.
+static int vm_copy(struct PBox* box, int to_sandbox,
+                   const struct PBoxCopyRegion* regions, size_t count) {
+    struct iovec local[PBOX_VM_IOV_MAX];
+    struct iovec remote[PBOX_VM_IOV_MAX];
+
+    if (!atomic_load_explicit(&box->vm_copy, memory_order_relaxed))
+        return -1;
+
+    size_t i = 0;
+    size_t offset = 0;  // Bytes of regions[i] already copied
+    while (i < count) {
+        unsigned long n = 0;
+        size_t want = 0;
+        for (size_t j = i; j < count && n < PBOX_VM_IOV_MAX; j++, n++) {
+            size_t skip = j == i ? offset : 0;
+            local[n].iov_base = (char*) regions[j].host_addr + skip;
+            local[n].iov_len = regions[j].len - skip;
+            remote[n].iov_base = (char*) regions[j].sandbox_addr + skip;
+            remote[n].iov_len = regions[j].len - skip;
+            want += local[n].iov_len;
+        }
+
+        ssize_t ret = to_sandbox
+            ? process_vm_writev(box->pid, local, n, remote, n, 0)
+            : process_vm_readv(box->pid, local, n, remote, n, 0);
+        if (ret < 0) {
+            if (errno == EPERM || errno == ENOSYS) {
+                atomic_store_explicit(&box->vm_copy, 0, memory_order_relaxed);
+                return -1;
+            }
+            if (errno != ESRCH)
+                perror(to_sandbox ? "pbox: process_vm_writev"
+                                  : "pbox: process_vm_readv");
+            return -2;
+        }
+        if (ret == 0 && want > 0) {
+            fprintf(stderr, "pbox: copy %s invalid sandbox address %p\n",
+                    to_sandbox ? "to" : "from", remote[0].iov_base);
+            return -2;
+        }
+
+        // Partial transfers stop at a region boundary or a bad page; resume
+        // from wherever the kernel got to.
+        size_t done = (size_t) ret;
+        while (i < count && done >= regions[i].len - offset) {
+            done -= regions[i].len - offset;
+            i++;
+            offset = 0;
+        }
+        offset += done;
+    }
+    return 0;
+}
+
+// Copy to sandbox memory through the channel's mem_storage window
+static void channel_copy_to(struct PBox* box, void* dest, const void* src,
+                            size_t n) {
     if (!box->sym_memcpy)
         return;
 
@@ -1034,80 +2648,284 @@ void pbox_copy_to(struct PBox* box, void* dest, const void* src, size_t n) {
         d += chunk;
         n -= chunk;
     }
+    channel_return(box);
 }
 
-// Get thread-local channel struct (not just the channel pointer)
-static struct PBoxThreadChannel* get_or_create_thread_channel(
-    struct PBox* box) {
-    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
-    if (tch)
-        return tch;
-
-    pthread_mutex_lock(&box->channel_lock);
-    tch = create_channel_locked(box);
-    pthread_mutex_unlock(&box->channel_lock);
+static void idmem_account(struct PBoxThreadChannel* tch, size_t delta) {
+    struct PBoxIdmemStats* st = &tch->idmem_stats;
+    st->in_use += delta;
+    if (st->in_use > st->high_water)
+        st->high_water = st->in_use;
+}
 
-    if (!tch)
+// Map a new identity chunk and link it at the end of *list
+static struct PBoxIdmemChunk* idmem_add_chunk(struct PBox* box,
+                                              struct PBoxThreadChannel* tch,
+                                              struct PBoxIdmemChunk** list,
+                                              size_t size) {
+    struct PBoxIdmemChunk* chunk = calloc(1, sizeof(*chunk));
+    if (!chunk)
+        return NULL;
+    chunk->base = pbox_mmap_identity(box, size, PROT_READ | PROT_WRITE);
+    if (!chunk->base) {
+        free(chunk);
         return NULL;
+    }
+    chunk->size = size;
 
-    pthread_setspecific(box->channel_key, tch);
-    return tch;
+    while (*list)
+        list = &(*list)->next;
+    *list = chunk;
+
+    tch->idmem_stats.mapped += size;
+    tch->idmem_stats.chunks++;
+    return chunk;
+}
+
+// Release all of a channel's identity memory without using the channel
+// (see identity_release_orphan)
+static void idmem_release(struct PBox* box, struct PBoxThreadChannel* tch) {
+    struct PBoxIdmemChunk* lists[] = {tch->idmem_scratch, tch->idmem_pools};
+    for (size_t i = 0; i < sizeof(lists) / sizeof(lists[0]); i++) {
+        struct PBoxIdmemChunk* chunk = lists[i];
+        while (chunk) {
+            struct PBoxIdmemChunk* next = chunk->next;
+            pbox_index_remove(&box->regions, chunk->base, chunk->size);
+            identity_release_orphan(box, chunk->base, chunk->size);
+            free(chunk->live);
+            free(chunk);
+            chunk = next;
+        }
+    }
+    tch->idmem_scratch = NULL;
+    tch->idmem_current = NULL;
+    tch->idmem_pools = NULL;
+}
+
+// Release the blocks a thread leaked when it exited, without using its
+// channel (see identity_release_orphan)
+static void idmem_release_pools(struct PBox* box,
+                                struct PBoxThreadChannel* tch) {
+    struct PBoxIdmemChunk* chunk = tch->idmem_pools;
+    while (chunk) {
+        struct PBoxIdmemChunk* next = chunk->next;
+        tch->idmem_stats.in_use -= chunk->used * chunk->block_size;
+        tch->idmem_stats.mapped -= chunk->size;
+        tch->idmem_stats.chunks--;
+        pbox_index_remove(&box->regions, chunk->base, chunk->size);
+        identity_release_orphan(box, chunk->base, chunk->size);
+        free(chunk->live);
+        free(chunk);
+        chunk = next;
+    }
+    tch->idmem_pools = NULL;
+    tch->idmem_pool_live = 0;
+}
+
+static size_t page_round(size_t size) {
+    return (size + 4095) & ~(size_t) 4095;
+}
+
+// Bump-allocate from the channel's scratch chunks
+static void* idmem_alloc_on(struct PBox* box, struct PBoxThreadChannel* tch,
+                            size_t size) {
+    // Align to 16 bytes
+    size = (size + 15) & ~(size_t) 15;
+
+    // Use the first chunk from the current one on with enough room. After a
+    // reset this walks back through the chunks mapped earlier.
+    struct PBoxIdmemChunk* chunk =
+        tch->idmem_current ? tch->idmem_current : tch->idmem_scratch;
+    while (chunk && chunk->size - chunk->used < size)
+        chunk = chunk->next;
+
+    if (!chunk) {
+        // Grow: each chunk is twice the last up to PBOX_IDMEM_MAX_GROWTH.
+        // Chunks made bigger for a single large allocation don't count.
+        size_t last_size = 0;
+        for (struct PBoxIdmemChunk* c = tch->idmem_scratch; c; c = c->next) {
+            if (c->size <= PBOX_IDMEM_MAX_GROWTH)
+                last_size = c->size;
+        }
+        size_t chunk_size = PBOX_IDMEM_DEFAULT_SIZE;
+        if (last_size >= PBOX_IDMEM_MAX_GROWTH / 2)
+            chunk_size = PBOX_IDMEM_MAX_GROWTH;
+        else if (last_size)
+            chunk_size = last_size * 2;
+        if (chunk_size < size)
+            chunk_size = page_round(size);
+        chunk = idmem_add_chunk(box, tch, &tch->idmem_scratch, chunk_size);
+        if (!chunk)
+            return NULL;
+    }
+
+    void* ptr = chunk->base + chunk->used;
+    chunk->used += size;
+    tch->idmem_current = chunk;
+    tch->idmem_scratch_used += size;
+    idmem_account(tch, size);
+    return ptr;
 }
 
 void* pbox_idmem_alloc(struct PBox* box, size_t size) {
+    if (size > SIZE_MAX - 4095)
+        return NULL;
     struct PBoxThreadChannel* tch = get_or_create_thread_channel(box);
     if (!tch)
         return NULL;
+    void* ptr = idmem_alloc_on(box, tch, size);
+    channel_return(box);
+    return ptr;
+}
+
+static void idmem_rewind(struct PBoxThreadChannel* tch) {
+    for (struct PBoxIdmemChunk* c = tch->idmem_scratch; c; c = c->next)
+        c->used = 0;
+    tch->idmem_current = tch->idmem_scratch;
+    tch->idmem_stats.in_use -= tch->idmem_scratch_used;
+    tch->idmem_scratch_used = 0;
+}
 
-    // Lazy initialization of identity region
-    if (!tch->idmem_base) {
-        tch->idmem_base = pbox_mmap_identity(box, PBOX_IDMEM_DEFAULT_SIZE,
-                                             PROT_READ | PROT_WRITE);
-        if (!tch->idmem_base)
+void pbox_idmem_reset(struct PBox* box) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (!tch)
+        return;
+    idmem_rewind(tch);
+    channel_release_idle(box, tch);
+}
+
+// Take a free block from a pool chunk, or return NULL if it is full
+static void* pool_take(struct PBoxIdmemChunk* chunk) {
+    size_t words = (chunk->nblocks + 63) / 64;
+    for (size_t n = 0; n < words; n++) {
+        size_t w = (chunk->hint + n) % words;
+        uint64_t bits = chunk->live[w];
+        if (w == words - 1 && chunk->nblocks % 64)
+            bits |= ~0ULL << (chunk->nblocks % 64);  // Past the last block
+        if (bits == ~0ULL)
+            continue;
+        unsigned b = __builtin_ctzll(~bits);
+        chunk->live[w] |= 1ULL << b;
+        chunk->hint = w;
+        chunk->used++;
+        return chunk->base + (w * 64 + b) * chunk->block_size;
+    }
+    return NULL;
+}
+
+// Allocate a block from the channel's pool chunks
+static void* idmem_malloc_on(struct PBox* box, struct PBoxThreadChannel* tch,
+                             size_t size) {
+    size_t block_size = PBOX_IDMEM_MIN_BLOCK;
+    while (block_size < size) {
+        if (block_size > SIZE_MAX / 2)
             return NULL;
-        tch->idmem_size = PBOX_IDMEM_DEFAULT_SIZE;
-        tch->idmem_offset = 0;
+        block_size *= 2;
     }
 
-    // Align to 16 bytes
-    size = (size + 15) & ~(size_t) 15;
+    for (struct PBoxIdmemChunk* c = tch->idmem_pools; c; c = c->next) {
+        if (c->block_size != block_size || c->used == c->nblocks)
+            continue;
+        void* ptr = pool_take(c);
+        if (ptr) {
+            idmem_account(tch, block_size);
+            tch->idmem_pool_live++;
+            return ptr;
+        }
+    }
 
-    // Check if we have space
-    if (tch->idmem_offset + size > tch->idmem_size)
+    // Blocks of the default size or larger get a chunk each
+    size_t chunk_size = block_size < PBOX_IDMEM_DEFAULT_SIZE
+                            ? PBOX_IDMEM_DEFAULT_SIZE
+                            : page_round(block_size);
+    size_t nblocks = chunk_size / block_size;
+    uint64_t* live = calloc((nblocks + 63) / 64, sizeof(uint64_t));
+    if (!live)
         return NULL;
+    struct PBoxIdmemChunk* chunk =
+        idmem_add_chunk(box, tch, &tch->idmem_pools, chunk_size);
+    if (!chunk) {
+        free(live);
+        return NULL;
+    }
+    chunk->block_size = block_size;
+    chunk->nblocks = nblocks;
+    chunk->live = live;
 
-    void* ptr = (char*) tch->idmem_base + tch->idmem_offset;
-    tch->idmem_offset += size;
+    void* ptr = pool_take(chunk);
+    idmem_account(tch, block_size);
+    tch->idmem_pool_live++;
     return ptr;
 }
 
-void pbox_idmem_reset(struct PBox* box) {
-    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
-    if (tch && tch->idmem_base)
-        tch->idmem_offset = 0;
+void* pbox_idmem_malloc(struct PBox* box, size_t size) {
+    struct PBoxThreadChannel* tch = get_or_create_thread_channel(box);
+    if (!tch)
+        return NULL;
+    void* ptr = idmem_malloc_on(box, tch, size);
+    channel_return(box);
+    return ptr;
 }
 
-int pbox_in_idmem(struct PBox* box, const void* ptr, size_t size) {
-    uintptr_t addr = (uintptr_t) ptr;
-    uintptr_t end = addr + size;
+void pbox_idmem_free(struct PBox* box, void* ptr) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (!tch || !ptr)
+        return;
 
-    pthread_mutex_lock(&box->channel_lock);
-    for (size_t i = 0; i < box->channel_count; i++) {
-        struct PBoxThreadChannel* tch = box->channels[i];
-        if (tch->idmem_base) {
-            uintptr_t base = (uintptr_t) tch->idmem_base;
-            uintptr_t top = base + tch->idmem_size;
-            if (addr >= base && end <= top) {
-                pthread_mutex_unlock(&box->channel_lock);
-                return 1;
-            }
-        }
+    struct PBoxIdmemChunk** link = &tch->idmem_pools;
+    struct PBoxIdmemChunk* chunk;
+    for (; (chunk = *link); link = &chunk->next) {
+        if ((char*) ptr >= chunk->base && (char*) ptr < chunk->base + chunk->size)
+            break;
     }
-    pthread_mutex_unlock(&box->channel_lock);
-    return 0;
+    if (!chunk)
+        return;
+
+    size_t off = (size_t) ((char*) ptr - chunk->base);
+    size_t index = off / chunk->block_size;
+    uint64_t bit = 1ULL << (index % 64);
+    if (off % chunk->block_size != 0 || index >= chunk->nblocks ||
+        !(chunk->live[index / 64] & bit))
+        return;  // Not the start of a live block
+    chunk->live[index / 64] &= ~bit;
+    chunk->used--;
+    chunk->hint = index / 64;
+    tch->idmem_stats.in_use -= chunk->block_size;
+    tch->idmem_pool_live--;
+
+    // Return dedicated chunks for large blocks to the system once free
+    if (chunk->nblocks == 1) {
+        char* base = chunk->base;
+        size_t size = chunk->size;
+        *link = chunk->next;
+        tch->idmem_stats.mapped -= size;
+        tch->idmem_stats.chunks--;
+        free(chunk->live);
+        free(chunk);
+        // A shared channel may be released by this, so tch is not touched
+        // afterwards
+        pbox_munmap_identity(box, base, size);
+        return;
+    }
+    channel_release_idle(box, tch);
 }
 
-void pbox_copy_from(struct PBox* box, void* dest, const void* src, size_t n) {
+void pbox_idmem_stats(struct PBox* box, struct PBoxIdmemStats* stats) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (tch)
+        *stats = tch->idmem_stats;
+    else
+        memset(stats, 0, sizeof(*stats));
+}
+
+int pbox_in_idmem(struct PBox* box, const void* ptr, size_t size) {
+    return pbox_heap_contains(&box->heap, ptr, size) ||
+           pbox_index_contains(&box->regions, ptr, size);
+}
+
+// Copy from sandbox memory through the channel's mem_storage window
+static void channel_copy_from(struct PBox* box, void* dest, const void* src,
+                              size_t n) {
     if (!box->sym_memcpy)
         return;
 
@@ -1147,4 +2965,65 @@ void pbox_copy_from(struct PBox* box, void* dest, const void* src, size_t n) {
         d += chunk;
         n -= chunk;
     }
+    channel_return(box);
+}
+
+void pbox_copy_to(struct PBox* box, void* dest, const void* src, size_t n) {
+    struct PBoxCopyRegion region = {dest, (void*) src, n};
+    pbox_copy_to_v(box, &region, 1);
+}
+
+void pbox_copy_from(struct PBox* box, void* dest, const void* src, size_t n) {
+    struct PBoxCopyRegion region = {(void*) src, dest, n};
+    pbox_copy_from_v(box, &region, 1);
+}
+
+// Complete this thread's async calls so a copy is ordered after them
+static void copy_quiesce(struct PBox* box) {
+    struct PBoxThreadChannel* tch = pthread_getspecific(box->channel_key);
+    if (tch)
+        ring_quiesce(box, tch);
+}
+
+// Copy directly if every sandbox region is in the shared heap
+static int heap_copy(struct PBox* box, int to_sandbox,
+                     const struct PBoxCopyRegion* regions, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (!pbox_heap_contains(&box->heap, regions[i].sandbox_addr,
+                                regions[i].len))
+            return -1;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (to_sandbox)
+            memcpy(regions[i].sandbox_addr, regions[i].host_addr,
+                   regions[i].len);
+        else
+            memcpy(regions[i].host_addr, regions[i].sandbox_addr,
+                   regions[i].len);
+    }
+    return 0;
+}
+
+void pbox_copy_to_v(struct PBox* box, const struct PBoxCopyRegion* regions,
+                    size_t count) {
+    copy_quiesce(box);
+    if (heap_copy(box, 1, regions, count) == 0)
+        return;
+    if (vm_copy(box, 1, regions, count) != -1)
+        return;
+    for (size_t i = 0; i < count; i++)
+        channel_copy_to(box, regions[i].sandbox_addr, regions[i].host_addr,
+                        regions[i].len);
+}
+
+void pbox_copy_from_v(struct PBox* box, const struct PBoxCopyRegion* regions,
+                      size_t count) {
+    copy_quiesce(box);
+    if (heap_copy(box, 0, regions, count) == 0)
+        return;
+    if (vm_copy(box, 0, regions, count) != -1)
+        return;
+    for (size_t i = 0; i < count; i++)
+        channel_copy_from(box, regions[i].host_addr, regions[i].sandbox_addr,
+                          regions[i].len);
 }
@@ -27,23 +27,156 @@ enum PBoxType {
 
 struct PBox;
 
+// How a thread waits for the other side of a channel.
+// Waiters spin (with PAUSE) for up to spin_max_ns before parking in
+// FUTEX_WAIT; wakes are only issued when the peer is actually parked.
+struct PBoxWaitPolicy {
+    // Longest spin phase in nanoseconds. 0 disables spinning.
+    uint32_t spin_max_ns;
+    // If nonzero, each channel sizes its spin phase from recently observed
+    // wait latencies (never above spin_max_ns). Otherwise always spin for
+    // the full spin_max_ns.
+    int adaptive;
+};
+
+struct PBoxZygote;
+
+// Options for pbox_create_with_options. Zero-initialize for the defaults.
+struct PBoxOptions {
+    // Worker channels to spawn ahead of time. A host thread's first call
+    // claims one of these instead of spawning its own worker, and the pool
+    // is refilled in the background by a thread shared by all sandboxes.
+    size_t prespawn_channels;
+
+    // If nonzero, host threads share at most this many worker channels
+    // instead of each owning one. A thread borrows a free channel for the
+    // duration of each call (waiting if all are busy) and keeps it while it
+    // has unclaimed async calls or identity memory from pbox_idmem_alloc or
+    // pbox_idmem_malloc outstanding. pbox_idmem_stats then reports the
+    // channel the thread currently holds. Prespawned channels count towards
+    // the limit and are not refilled.
+    size_t max_channels;
+
+    // If set, the sandbox is forked from this zygote (see
+    // pbox_zygote_create) instead of spawned from the executable. The
+    // executable passed to pbox_create_with_options is then ignored.
+    struct PBoxZygote* zygote;
+
+    // Address space reserved at creation, at the same address in the host
+    // and the sandbox, for pbox_mmap_identity and the identity arenas to
+    // carve mappings from. Each sandbox reserves this much host address
+    // space (though no memory until it is used), so with many sandboxes it
+    // should stay small. Mappings that don't fit are made one at a time,
+    // which costs more round trips. 0 selects the default of 256MB, and
+    // PBOX_IDENTITY_WINDOW_NONE reserves nothing.
+    size_t identity_window;
+};
+
+#define PBOX_IDENTITY_WINDOW_NONE ((size_t) -1)
+
 // Initialize a sandbox running the given executable
 // Returns NULL on failure
 struct PBox* pbox_create(const char* sandbox_executable);
+struct PBox* pbox_create_with_options(const char* sandbox_executable,
+                                      const struct PBoxOptions* options);
 
 // Destroy a sandbox and free resources
 void pbox_destroy(struct PBox* box);
 
+// Start a zygote: the sandbox executable, run in a mode where it loads and
+// initializes its libraries once and then forks a copy-on-write child for
+// each sandbox created with PBoxOptions.zygote. Such sandboxes share the
+// zygote's initialized pages and start without an exec or dynamic linking.
+// Returns NULL on failure.
+struct PBoxZygote* pbox_zygote_create(const char* sandbox_executable);
+
+// Stop the zygote. Sandboxes already forked from it keep running.
+void pbox_zygote_destroy(struct PBoxZygote* zygote);
+
 // Get the sandbox process ID
 pid_t pbox_pid(const struct PBox* box);
 
 // Check if the sandbox is still alive
 int pbox_alive(const struct PBox* box);
 
+// Pool of sandboxes created ahead of time, so that taking a fresh sandbox
+// costs a lock rather than a fork, exec and symbol lookups. A background
+// thread keeps `size` sandboxes ready and destroys retired ones.
+struct PBoxPool;
+
+// Create a pool of sandboxes running the given executable, each created
+// with options (may be NULL) and with the given symbols already resolved.
+// Returns NULL on failure.
+struct PBoxPool* pbox_pool_create(const char* sandbox_executable, size_t size,
+                                  const struct PBoxOptions* options,
+                                  const char* const* symbols,
+                                  size_t symbol_count);
+
+// Take a sandbox from the pool, creating one if none is ready. If addrs is
+// not NULL, stores the addresses of the pool's symbols in it (NULL for
+// those not found). Returns NULL if no sandbox could be created.
+struct PBox* pbox_pool_acquire(struct PBoxPool* pool, void** addrs);
+
+// Hand a sandbox from pbox_pool_acquire back for destruction in the
+// background. Sandboxes are never reused.
+void pbox_pool_retire(struct PBoxPool* pool, struct PBox* box);
+
+// Number of sandboxes ready to be acquired
+size_t pbox_pool_ready(struct PBoxPool* pool);
+
+// Destroy the pool and every sandbox it still holds. Sandboxes already
+// acquired are unaffected and must be destroyed with pbox_destroy.
+void pbox_pool_destroy(struct PBoxPool* pool);
+
+// Set the wait policy for all channels of the sandbox (host and sandbox
+// side). The default is adaptive spinning on multi-core machines and no
+// spinning on single-core ones. This also replaces busy-poll's spinning,
+// though workers stay on their busy-poll CPUs until busy-poll is turned off.
+void pbox_set_wait_policy(struct PBox* box,
+                          const struct PBoxWaitPolicy* policy);
+
+// Get the current wait policy
+struct PBoxWaitPolicy pbox_get_wait_policy(const struct PBox* box);
+
+// Busy-poll mode, for the lowest latency at the cost of a core per worker.
+// Both sides poll their channels with PAUSE for up to idle_ns after the
+// last activity, without the adaptive cut-off, before falling back to
+// futex sleep. If cpus is given, workers are spread over those CPUs
+// round-robin and each moves to its CPU before its next wait. An idle_ns
+// of 0 turns busy-poll off, restoring the wait policy it replaced and
+// unpinning the workers it placed.
+// Returns 0 on success, -1 with errno set on failure.
+int pbox_set_busy_poll(struct PBox* box, uint32_t idle_ns, const int* cpus,
+                       size_t cpu_count);
+
+#define PBOX_CPU_SIBLING (-1)  // Next to the calling thread
+#define PBOX_CPU_ANY (-2)      // No pinning
+
+// Pin the worker serving the calling thread's channel to a CPU, so that the
+// handoffs between the two stay in shared caches. PBOX_CPU_SIBLING picks
+// the SMT sibling of the CPU the calling thread is running on (that CPU
+// itself if it has none); the caller should be pinned too for this to last.
+// With shared channels (PBoxOptions.max_channels) this applies to whichever
+// channel the thread borrows for the request.
+// Returns 0 on success, -1 with errno set on failure.
+int pbox_pin_worker(struct PBox* box, int cpu);
+
+// Set the scheduling policy of the worker serving the calling thread's
+// channel, as sched_setscheduler would. The sandbox only permits
+// SCHED_OTHER, SCHED_BATCH and SCHED_IDLE.
+// Returns 0 on success, -1 with errno set on failure.
+int pbox_set_worker_sched(struct PBox* box, int policy, int priority);
+
 // Look up a symbol address in the sandbox
 // Returns NULL if not found
 void* pbox_dlsym(struct PBox* box, const char* symbol);
 
+// Look up several symbols, with one round trip for up to 128 names.
+// Stores each address (NULL if not found) in addrs[i].
+// Returns the number of symbols found
+size_t pbox_dlsym_many(struct PBox* box, const char* const* symbols,
+                       size_t count, void** addrs);
+
 // Call a function in the sandbox
 // func_addr: address from pbox_dlsym
 // ret_type: return type (PBOX_TYPE_*)
@@ -55,6 +188,91 @@ void pbox_call(struct PBox* box, void* func_addr, enum PBoxType ret_type,
                int nargs, const enum PBoxType* arg_types, void** args,
                void* ret);
 
+// Describe a call signature to the sandbox, which classifies its arguments
+// once instead of on every call. Describing the same signature again returns
+// the same descriptor.
+// Returns a descriptor for pbox_call_desc, or -1 if the sandbox is dead,
+// can't make calls with this signature from a descriptor, or 128 signatures
+// have already been described.
+int pbox_describe_call(struct PBox* box, enum PBoxType ret_type, int nargs,
+                       const enum PBoxType* arg_types);
+
+// Call a function with a described signature. Argument i is memcpy'd into
+// the start of args[i]; ret is as for pbox_call.
+void pbox_call_desc(struct PBox* box, int desc, void* func_addr,
+                    const uint64_t* args, void* ret);
+
+// Flags for PBoxInlineArg
+#define PBOX_INLINE_IN 1   // Copied into the message before the call
+#define PBOX_INLINE_OUT 2  // Copied back out when the call returns
+#define PBOX_INLINE_MAX 944  // Bytes of inline buffers per call
+
+// A by-pointer argument carried in the call message (see pbox_call_inline)
+struct PBoxInlineArg {
+    int index;   // Pointer argument the buffer replaces
+    void* data;  // Host buffer
+    size_t size;
+    int flags;   // PBOX_INLINE_IN and/or PBOX_INLINE_OUT
+};
+
+// As pbox_call, but with small buffers carried in the call message itself.
+// Argument inl[i].index is replaced by a pointer to a copy of inl[i].data
+// inside the channel, so the buffer needs no sandbox allocation or separate
+// copy. Each buffer takes its size rounded up to 16 bytes, and together they
+// must fit in PBOX_INLINE_MAX. Buffers not marked PBOX_INLINE_IN start out
+// zeroed.
+// Returns 0 on success. Returns -1 without making the call if the buffers
+// do not fit or an index is invalid, leaving ret and the buffers untouched.
+// Also returns -1 if the call could not be made or the sandbox died during
+// it, in which case ret and the PBOX_INLINE_OUT buffers are zeroed.
+int pbox_call_inline(struct PBox* box, void* func_addr, enum PBoxType ret_type,
+                     int nargs, const enum PBoxType* arg_types, void** args,
+                     const struct PBoxInlineArg* inl, int ninline, void* ret);
+
+// Token identifying an asynchronous call (0 = invalid)
+typedef uint64_t pbox_token_t;
+
+// Start a call in the sandbox without waiting for it to finish.
+// Arguments are as for pbox_call; they are copied before returning.
+// Returns a token for pbox_poll/pbox_wait, or 0 on failure.
+//
+// Async calls use the calling thread's channel, so tokens are only valid on
+// the thread that created them. Calls run in submission order, and up to
+// 32 of them can be queued per thread; submitting more waits for the oldest
+// to finish. Starting a synchronous call on the same thread first
+// completes every queued one. A result is kept until claimed with pbox_wait
+// or until 32 newer calls have been submitted.
+pbox_token_t pbox_call_async(struct PBox* box, void* func_addr,
+                             enum PBoxType ret_type, int nargs,
+                             const enum PBoxType* arg_types, void** args);
+
+// Check whether an async call has completed (dispatching any callbacks it
+// made). Returns 1 if complete, 0 if still running, -1 if the token is
+// invalid or its result is no longer available.
+int pbox_poll(struct PBox* box, pbox_token_t token);
+
+// Wait for an async call to complete and store its return value in ret
+// (can be NULL). Each token can be waited for once.
+// Returns 0 on success, -1 if the token is invalid or its result is no
+// longer available.
+int pbox_wait(struct PBox* box, pbox_token_t token, void* ret);
+
+// One call of a batch (see pbox_call_batch). Fields are as for pbox_call.
+struct PBoxBatchCall {
+    void* func_addr;
+    enum PBoxType ret_type;
+    int nargs;
+    const enum PBoxType* arg_types;
+    void** args;
+    void* ret;  // Can be NULL
+};
+
+// Run a batch of calls in order with a single round trip to the sandbox
+// (one per 32 calls), storing each return value in its ret.
+// Returns 0 on success, -1 if the sandbox died.
+int pbox_call_batch(struct PBox* box, const struct PBoxBatchCall* calls,
+                    int ncalls);
+
 // Copy data to sandbox memory
 // dest: address in sandbox (from pbox_malloc)
 // src: pointer in host memory
@@ -67,7 +285,26 @@ void pbox_copy_to(struct PBox* box, void* dest, const void* src, size_t n);
 // n: number of bytes
 void pbox_copy_from(struct PBox* box, void* dest, const void* src, size_t n);
 
+// One region of a vectored copy
+struct PBoxCopyRegion {
+    void* sandbox_addr;
+    void* host_addr;
+    size_t len;
+};
+
+// Copy several regions to or from sandbox memory in one pass.
+// Copies use process_vm_writev/readv where the kernel allows it, and
+// otherwise go through the calling thread's channel.
+void pbox_copy_to_v(struct PBox* box, const struct PBoxCopyRegion* regions,
+                    size_t count);
+void pbox_copy_from_v(struct PBox* box, const struct PBoxCopyRegion* regions,
+                      size_t count);
+
 // Memory allocation in sandbox
+// The sandbox's malloc serves from a heap that is identity-mapped into the
+// host. These allocate from it directly, without a round trip, so the
+// results can be accessed by the host (see pbox_in_idmem). If the heap is
+// unavailable or full, they call the sandbox's allocator instead.
 void* pbox_malloc(struct PBox* box, size_t size);
 void* pbox_calloc(struct PBox* box, size_t nmemb, size_t size);
 void* pbox_realloc(struct PBox* box, void* p, size_t size);
@@ -88,19 +325,42 @@ int pbox_munmap(struct PBox* box, void* addr, size_t length);
 // Returns NULL on failure
 void* pbox_mmap_identity(struct PBox* box, size_t length, int prot);
 
-// Unmap identity-mapped memory (unmaps in both host and sandbox)
+// Unmap identity-mapped memory (unmaps in both host and sandbox). Memory
+// carved from the identity window can only be unmapped whole: addr and
+// length must be those of a pbox_mmap_identity call, or this fails with
+// EINVAL.
 int pbox_munmap_identity(struct PBox* box, void* addr, size_t length);
 
-// Arena allocator for per-channel identity-mapped memory
-// Each thread's channel has a dedicated identity region
+// Arena allocator for per-thread identity-mapped memory
+// Each thread has its own arena, which maps further identity regions as it
+// fills up, so allocations are limited only by available memory.
 // Returns pointer valid in both host and sandbox, or NULL on failure
 void* pbox_idmem_alloc(struct PBox* box, size_t size);
 
-// Reset arena, freeing all allocations from the current channel's identity
-// region
+// Reset arena, freeing all pbox_idmem_alloc allocations made by the current
+// thread. The regions stay mapped for reuse.
 void pbox_idmem_reset(struct PBox* box);
 
-// Check if [ptr, ptr+size) falls within any identity-mapped region
+// Allocate identity-mapped memory that survives pbox_idmem_reset, for
+// long-lived buffers. Sizes are rounded up to a power of two, at least 16.
+// Must be freed with pbox_idmem_free on the same thread.
+// Returns NULL on failure
+void* pbox_idmem_malloc(struct PBox* box, size_t size);
+void pbox_idmem_free(struct PBox* box, void* ptr);
+
+// Identity memory usage of the calling thread's arena
+struct PBoxIdmemStats {
+    size_t mapped;      // Bytes of identity regions mapped
+    size_t chunks;      // Number of identity regions mapped
+    size_t in_use;      // Bytes currently allocated
+    size_t high_water;  // Largest in_use so far
+};
+
+void pbox_idmem_stats(struct PBox* box, struct PBoxIdmemStats* stats);
+
+// Check if [ptr, ptr+size) falls within any identity-mapped region,
+// including the shared heap. Takes no locks, so it is cheap to call from
+// many threads at once.
 // Returns 1 if valid, 0 otherwise
 int pbox_in_idmem(struct PBox* box, const void* ptr, size_t size);
 
@@ -108,6 +368,14 @@ int pbox_in_idmem(struct PBox* box, const void* ptr, size_t size);
 // Returns the fd number in the sandbox, or -1 on error
 int pbox_send_fd(struct PBox* box, int fd);
 
+// Send several file descriptors to the sandbox, writing the sandbox fd for
+// fds[i] to sandbox_fds[i]. Fds sent before are translated without a round
+// trip, and the rest go in as few messages as possible: one, unless there
+// are more than the kernel passes at once. Negative fds are passed through.
+// Returns 0 on success, -1 if any fd could not be sent.
+int pbox_send_fds(struct PBox* box, const int* fds, size_t count,
+                  int* sandbox_fds);
+
 // Close a file descriptor in the sandbox
 // Takes the sandbox fd (returned by pbox_send_fd)
 int pbox_close(struct PBox* box, int sandbox_fd);
@@ -131,6 +399,16 @@ void* pbox_register_callback(struct PBox* box, pbox_fn_t host_func,
                              enum PBoxType ret_type, int nargs,
                              const enum PBoxType* arg_types);
 
+// Register a host function returning void as a one-way callback. The
+// sandbox queues each invocation and carries on without waiting for it.
+// Queued invocations run in order on the host thread that made the
+// enclosing call: before any synchronous callback it makes, and when the
+// call completes (for async calls, once the channel's worker is idle).
+void* pbox_register_oneway_callback(struct PBox* box, pbox_fn_t host_func,
+                                    pbox_callback_dispatch_fn dispatch,
+                                    int nargs,
+                                    const enum PBoxType* arg_types);
+
 
 // Convenience macros for common calling patterns
 // Usage: pbox_callN(box, fn, ret_ctype, ret_ptype, ctype0, ptype0, val0, ...)
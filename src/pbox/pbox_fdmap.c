@@ -0,0 +1,174 @@
+#define _GNU_SOURCE
+
+#include "pbox_fdmap.h"
+
+#include <stdlib.h>
+
+#define PBOX_FDMAP_MIN_CAP 16
+
+// Fds are small, densely allocated integers, so consecutive fds land in
+// consecutive stripes and, within a stripe, consecutive slots
+static struct PBoxFdStripe* stripe_of(struct PBoxFdStripe* stripes, int key) {
+    return &stripes[(unsigned) key % PBOX_FDMAP_STRIPES];
+}
+
+static size_t home_of(const struct PBoxFdStripe* s, int key) {
+    return ((unsigned) key / PBOX_FDMAP_STRIPES) & (s->cap - 1);
+}
+
+// Returns the slot holding key, or -1 (must hold s->lock)
+static long stripe_find(const struct PBoxFdStripe* s, int key) {
+    if (key < 0 || s->count == 0)
+        return -1;
+    size_t mask = s->cap - 1;
+    for (size_t i = home_of(s, key);; i = (i + 1) & mask) {
+        if (s->slots[i].key == key)
+            return (long) i;
+        if (s->slots[i].key < 0)
+            return -1;
+    }
+}
+
+// Empty slot i, shifting later entries of its probe run back so that no
+// run has a gap (must hold s->lock)
+static void stripe_erase(struct PBoxFdStripe* s, size_t i) {
+    size_t mask = s->cap - 1;
+    for (size_t j = (i + 1) & mask; s->slots[j].key >= 0; j = (j + 1) & mask) {
+        // The entry at j may fill the gap if the gap lies on its probe path
+        size_t home = home_of(s, s->slots[j].key);
+        if (((j - home) & mask) >= ((j - i) & mask)) {
+            s->slots[i] = s->slots[j];
+            i = j;
+        }
+    }
+    s->slots[i].key = -1;
+    s->count--;
+}
+
+static void stripe_place(struct PBoxFdStripe* s, int key, int value) {
+    size_t mask = s->cap - 1;
+    size_t i = home_of(s, key);
+    while (s->slots[i].key >= 0)
+        i = (i + 1) & mask;
+    s->slots[i].key = key;
+    s->slots[i].value = value;
+    s->count++;
+}
+
+// Set key's value. Returns the value it replaces, -1 if it had none, or -2
+// if out of memory or key is negative (must hold s->lock).
+static int stripe_put(struct PBoxFdStripe* s, int key, int value) {
+    if (key < 0)
+        return -2;
+    long i = stripe_find(s, key);
+    if (i >= 0) {
+        int old = s->slots[i].value;
+        s->slots[i].value = value;
+        return old;
+    }
+
+    // Keep the load factor under 3/4
+    if ((s->count + 1) * 4 > s->cap * 3) {
+        size_t cap = s->cap ? s->cap * 2 : PBOX_FDMAP_MIN_CAP;
+        struct PBoxFdPair* slots = malloc(cap * sizeof(*slots));
+        if (!slots)
+            return -2;
+        for (size_t k = 0; k < cap; k++) {
+            slots[k].key = -1;
+            slots[k].value = -1;
+        }
+
+        struct PBoxFdPair* old_slots = s->slots;
+        size_t old_cap = s->cap;
+        s->slots = slots;
+        s->cap = cap;
+        s->count = 0;
+        for (size_t k = 0; k < old_cap; k++) {
+            if (old_slots[k].key >= 0)
+                stripe_place(s, old_slots[k].key, old_slots[k].value);
+        }
+        free(old_slots);
+    }
+    stripe_place(s, key, value);
+    return -1;
+}
+
+// Remove key if it maps to value, or whatever it maps to if value is -1.
+// Returns the value removed, or -1.
+static int drop(struct PBoxFdStripe* stripes, int key, int value) {
+    struct PBoxFdStripe* s = stripe_of(stripes, key);
+    pthread_mutex_lock(&s->lock);
+    int removed = -1;
+    long i = stripe_find(s, key);
+    if (i >= 0 && (value < 0 || s->slots[i].value == value)) {
+        removed = s->slots[i].value;
+        stripe_erase(s, (size_t) i);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return removed;
+}
+
+static int put(struct PBoxFdStripe* stripes, int key, int value) {
+    struct PBoxFdStripe* s = stripe_of(stripes, key);
+    pthread_mutex_lock(&s->lock);
+    int old = stripe_put(s, key, value);
+    pthread_mutex_unlock(&s->lock);
+    return old;
+}
+
+void pbox_fdmap_init(struct PBoxFdMap* map) {
+    for (int i = 0; i < PBOX_FDMAP_STRIPES; i++) {
+        struct PBoxFdStripe* dirs[] = {&map->to_sandbox[i], &map->to_host[i]};
+        for (int d = 0; d < 2; d++) {
+            pthread_mutex_init(&dirs[d]->lock, NULL);
+            dirs[d]->slots = NULL;
+            dirs[d]->cap = 0;
+            dirs[d]->count = 0;
+        }
+    }
+}
+
+void pbox_fdmap_destroy(struct PBoxFdMap* map) {
+    for (int i = 0; i < PBOX_FDMAP_STRIPES; i++) {
+        pthread_mutex_destroy(&map->to_sandbox[i].lock);
+        pthread_mutex_destroy(&map->to_host[i].lock);
+        free(map->to_sandbox[i].slots);
+        free(map->to_host[i].slots);
+    }
+}
+
+int pbox_fdmap_lookup(struct PBoxFdMap* map, int host_fd) {
+    struct PBoxFdStripe* s = stripe_of(map->to_sandbox, host_fd);
+    pthread_mutex_lock(&s->lock);
+    long i = stripe_find(s, host_fd);
+    int sandbox_fd = i >= 0 ? s->slots[i].value : -1;
+    pthread_mutex_unlock(&s->lock);
+    return sandbox_fd;
+}
+
+int pbox_fdmap_insert(struct PBoxFdMap* map, int host_fd, int sandbox_fd) {
+    if (host_fd < 0 || sandbox_fd < 0)
+        return -1;
+    int old_sandbox = put(map->to_sandbox, host_fd, sandbox_fd);
+    if (old_sandbox == -2)
+        return -1;
+    if (old_sandbox >= 0 && old_sandbox != sandbox_fd)
+        drop(map->to_host, old_sandbox, host_fd);
+
+    // A sandbox fd number comes back once the sandbox has closed the fd,
+    // which it may have done without telling us
+    int old_host = put(map->to_host, sandbox_fd, host_fd);
+    if (old_host == -2) {
+        drop(map->to_sandbox, host_fd, sandbox_fd);
+        return -1;
+    }
+    if (old_host >= 0 && old_host != host_fd)
+        drop(map->to_sandbox, old_host, sandbox_fd);
+    return 0;
+}
+
+void pbox_fdmap_remove(struct PBoxFdMap* map, int sandbox_fd) {
+    int host_fd = drop(map->to_host, sandbox_fd, -1);
+    if (host_fd >= 0)
+        drop(map->to_sandbox, host_fd, sandbox_fd);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Two-way map between host fds and the sandbox fds they were sent as.
+//
+// Each direction is a hash table split into stripes by key, each stripe
+// with its own lock, so threads translating different fds rarely contend.
+// A pair is entered in one direction and then the other, never under both
+// locks, so a concurrent lookup may briefly see it in only one of them.
+
+#define PBOX_FDMAP_STRIPES 16
+
+struct PBoxFdPair {
+    int key;  // -1 marks a free slot
+    int value;
+};
+
+struct PBoxFdStripe {
+    pthread_mutex_t lock;
+    struct PBoxFdPair* slots;  // Linear probing
+    size_t cap;                // Power of two, or 0 before the first insert
+    size_t count;
+};
+
+struct PBoxFdMap {
+    struct PBoxFdStripe to_sandbox[PBOX_FDMAP_STRIPES];  // Keyed by host fd
+    struct PBoxFdStripe to_host[PBOX_FDMAP_STRIPES];     // Keyed by sandbox fd
+};
+
+void pbox_fdmap_init(struct PBoxFdMap* map);
+
+// Free the map. No other calls may be in progress.
+void pbox_fdmap_destroy(struct PBoxFdMap* map);
+
+// Returns the sandbox fd host_fd was sent as, or -1 if it hasn't been
+int pbox_fdmap_lookup(struct PBoxFdMap* map, int host_fd);
+
+// Record that host_fd was sent as sandbox_fd, replacing any pair either of
+// them was in. Returns 0 on success, -1 if either is negative or out of
+// memory, in which case neither is mapped afterwards.
+int pbox_fdmap_insert(struct PBoxFdMap* map, int host_fd, int sandbox_fd);
+
+// Forget the pair sandbox_fd is in, if any
+void pbox_fdmap_remove(struct PBoxFdMap* map, int sandbox_fd);
@@ -0,0 +1,189 @@
+#define _GNU_SOURCE
+
+#include "pbox_heap.h"
+
+#include "pbox_internal.h"
+
+#include <sched.h>
+#include <stdint.h>
+
+// Blocks come in power-of-two size classes of 32 << class bytes, header
+// included, and are recycled through a free list per class. Space that was
+// never allocated is handed out from top.
+#define PBOX_HEAP_CLASSES 24  // Largest block is 256MB
+#define PBOX_HEAP_MIN_BLOCK 32
+#define PBOX_HEAP_LOCK_TIMEOUT_NS 1000000  // Bounded lock gives up after 1ms
+
+#define PBOX_HEAP_BLOCK_USED 0x75736564u  // "used"
+#define PBOX_HEAP_BLOCK_FREE 0x66726565u  // "free"
+
+// Heap header, at the start of the heap
+struct PBoxHeapHeader {
+    atomic_int lock;
+    uint64_t top;  // Offset of the first never-allocated byte
+    uint64_t free_lists[PBOX_HEAP_CLASSES];  // Offset of first free block
+};
+
+// Block header, immediately before each allocation
+struct PBoxHeapBlock {
+    uint32_t magic;
+    uint32_t size_class;
+    uint64_t next;  // Next free block of the same class (while free)
+};
+
+_Static_assert(sizeof(struct PBoxHeapBlock) == 16,
+               "block header must keep allocations 16-byte aligned");
+
+#define PBOX_HEAP_DATA_START \
+    ((sizeof(struct PBoxHeapHeader) + 15) & ~(size_t) 15)
+
+static struct PBoxHeapHeader* heap_header(const struct PBoxHeap* heap) {
+    return (struct PBoxHeapHeader*) heap->base;
+}
+
+static uint64_t block_size(unsigned size_class) {
+    return (uint64_t) PBOX_HEAP_MIN_BLOCK << size_class;
+}
+
+// Check that a block of the given class at off lies inside the heap
+static int valid_block(const struct PBoxHeap* heap, uint64_t off,
+                       unsigned size_class) {
+    if (size_class >= PBOX_HEAP_CLASSES)
+        return 0;
+    if (off < PBOX_HEAP_DATA_START || off % 16 != 0 || off > heap->size)
+        return 0;
+    return block_size(size_class) <= heap->size - off;
+}
+
+// Find the block header for an allocation, or NULL if ptr cannot be one.
+// The block's class is read once into *class_out, since the sandbox may
+// change the header at any time.
+static struct PBoxHeapBlock* find_block(const struct PBoxHeap* heap,
+                                        const void* ptr, uint64_t* off_out,
+                                        unsigned* class_out) {
+    if (!pbox_heap_contains(heap, ptr, 1) ||
+        (uintptr_t) ptr - (uintptr_t) heap->base < PBOX_HEAP_DATA_START +
+                                                   sizeof(struct PBoxHeapBlock))
+        return NULL;
+    uint64_t off = (uint64_t) ((const char*) ptr - heap->base) -
+                   sizeof(struct PBoxHeapBlock);
+    struct PBoxHeapBlock* block = (struct PBoxHeapBlock*) (heap->base + off);
+    unsigned size_class =
+        __atomic_load_n(&block->size_class, __ATOMIC_RELAXED);
+    if (!valid_block(heap, off, size_class))
+        return NULL;
+    *off_out = off;
+    *class_out = size_class;
+    return block;
+}
+
+static int heap_lock(struct PBoxHeapHeader* hdr, int bounded) {
+    uint64_t deadline = 0;
+    for (unsigned spins = 1;; spins++) {
+        if (!atomic_load_explicit(&hdr->lock, memory_order_relaxed) &&
+            !atomic_exchange_explicit(&hdr->lock, 1, memory_order_acquire))
+            return 0;
+        PAUSE();
+        if (spins % PBOX_SPIN_CHECK_EVERY != 0)
+            continue;
+        sched_yield();
+        if (bounded) {
+            uint64_t now = pbox_now_ns();
+            if (!deadline)
+                deadline = now + PBOX_HEAP_LOCK_TIMEOUT_NS;
+            else if (now > deadline)
+                return -1;
+        }
+    }
+}
+
+static void heap_unlock(struct PBoxHeapHeader* hdr) {
+    atomic_store_explicit(&hdr->lock, 0, memory_order_release);
+}
+
+void pbox_heap_format(void* base, size_t size) {
+    struct PBoxHeapHeader* hdr = base;
+    atomic_init(&hdr->lock, 0);
+    hdr->top = PBOX_HEAP_DATA_START;
+    for (int i = 0; i < PBOX_HEAP_CLASSES; i++)
+        hdr->free_lists[i] = 0;
+    (void) size;
+}
+
+void* pbox_heap_alloc(const struct PBoxHeap* heap, size_t size, int bounded) {
+    if (!heap->base || size > heap->size)
+        return NULL;
+
+    unsigned size_class = 0;
+    while (block_size(size_class) < size + sizeof(struct PBoxHeapBlock)) {
+        if (++size_class == PBOX_HEAP_CLASSES)
+            return NULL;
+    }
+    uint64_t bsize = block_size(size_class);
+
+    struct PBoxHeapHeader* hdr = heap_header(heap);
+    if (heap_lock(hdr, bounded) < 0)
+        return NULL;
+
+    uint64_t off = hdr->free_lists[size_class];
+    struct PBoxHeapBlock* block;
+    if (off && valid_block(heap, off, size_class)) {
+        block = (struct PBoxHeapBlock*) (heap->base + off);
+        hdr->free_lists[size_class] = block->next;
+    } else {
+        // Empty list, or one the sandbox corrupted: drop it.
+        hdr->free_lists[size_class] = 0;
+        uint64_t top = hdr->top;
+        if (top < PBOX_HEAP_DATA_START || top % 16 != 0 || top > heap->size ||
+            heap->size - top < bsize) {
+            heap_unlock(hdr);
+            return NULL;
+        }
+        off = top;
+        hdr->top = top + bsize;
+        block = (struct PBoxHeapBlock*) (heap->base + off);
+    }
+
+    block->magic = PBOX_HEAP_BLOCK_USED;
+    block->size_class = size_class;
+    block->next = 0;
+    heap_unlock(hdr);
+    return block + 1;
+}
+
+int pbox_heap_free(const struct PBoxHeap* heap, void* ptr, int bounded) {
+    uint64_t off;
+    unsigned size_class;
+    struct PBoxHeapBlock* block = find_block(heap, ptr, &off, &size_class);
+    if (!block || block->magic != PBOX_HEAP_BLOCK_USED)
+        return 0;
+
+    struct PBoxHeapHeader* hdr = heap_header(heap);
+    if (heap_lock(hdr, bounded) < 0)
+        return -1;
+
+    block->magic = PBOX_HEAP_BLOCK_FREE;
+    block->size_class = size_class;
+    block->next = hdr->free_lists[size_class];
+    hdr->free_lists[size_class] = off;
+    heap_unlock(hdr);
+    return 0;
+}
+
+size_t pbox_heap_usable_size(const struct PBoxHeap* heap, const void* ptr) {
+    uint64_t off;
+    unsigned size_class;
+    if (!find_block(heap, ptr, &off, &size_class))
+        return 0;
+    return block_size(size_class) - sizeof(struct PBoxHeapBlock);
+}
+
+int pbox_heap_contains(const struct PBoxHeap* heap, const void* ptr,
+                       size_t size) {
+    if (!heap->base)
+        return 0;
+    uintptr_t addr = (uintptr_t) ptr;
+    uintptr_t base = (uintptr_t) heap->base;
+    return addr >= base && addr - base <= heap->size &&
+           size <= heap->size - (addr - base);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stddef.h>
+
+// Shared sandbox heap: a memfd region identity-mapped into the host and the
+// sandbox. Both sides allocate from it with the functions below, so host
+// allocations need no round trip and the host can access heap objects
+// directly.
+//
+// The allocator's metadata lives in the heap itself and the sandbox can
+// overwrite it. Every offset read from the heap is therefore validated
+// against the bounds in struct PBoxHeap (kept in private memory), so a
+// corrupted heap can only hand out bad blocks within the heap, never make
+// the caller touch memory outside it.
+
+#define PBOX_HEAP_SIZE (1ULL << 28)  // 256MB, populated on demand
+
+struct PBoxHeap {
+    char* base;  // NULL if there is no shared heap
+    size_t size;
+};
+
+// Lay out an empty heap in [base, base + size)
+void pbox_heap_format(void* base, size_t size);
+
+// Allocate from the heap. If bounded is set, gives up (returning NULL)
+// rather than waiting long for the heap lock, since the sandbox may hold it.
+// Returns NULL if the heap is exhausted or the lock was not taken.
+void* pbox_heap_alloc(const struct PBoxHeap* heap, size_t size, int bounded);
+
+// Free a block allocated from the heap. Invalid blocks are ignored.
+// Returns 0 on success, -1 if bounded and the lock was not taken.
+int pbox_heap_free(const struct PBoxHeap* heap, void* ptr, int bounded);
+
+// Usable size of a heap block, or 0 if ptr is not a valid block
+size_t pbox_heap_usable_size(const struct PBoxHeap* heap, const void* ptr);
+
+// Check whether [ptr, ptr + size) lies inside the heap
+int pbox_heap_contains(const struct PBoxHeap* heap, const void* ptr,
+                       size_t size);
@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+
+#include "pbox_index.h"
+
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Hazard slots, one per thread that has done a lookup. Slots are never
+// freed: when a thread exits its slot is released for the next thread to
+// claim, so the list is bounded by the peak number of threads.
+struct HazardSlot {
+    _Atomic(struct PBoxRegionTable*) table;  // Table being searched, or NULL
+    atomic_int owned;
+    struct HazardSlot* next;
+};
+
+static _Atomic(struct HazardSlot*) hazard_slots;
+static pthread_key_t hazard_key;
+static pthread_once_t hazard_once = PTHREAD_ONCE_INIT;
+static __thread struct HazardSlot* hazard_mine;
+
+static void hazard_release(void* ptr) {
+    struct HazardSlot* slot = ptr;
+    atomic_store(&slot->table, NULL);
+    atomic_store(&slot->owned, 0);
+    hazard_mine = NULL;
+}
+
+static void hazard_key_create(void) {
+    pthread_key_create(&hazard_key, hazard_release);
+}
+
+// Claim the calling thread's slot. Returns NULL if out of memory.
+static struct HazardSlot* hazard_slot(void) {
+    if (hazard_mine)
+        return hazard_mine;
+    pthread_once(&hazard_once, hazard_key_create);
+
+    struct HazardSlot* slot;
+    for (slot = atomic_load(&hazard_slots); slot; slot = slot->next) {
+        int expected = 0;
+        if (atomic_compare_exchange_strong(&slot->owned, &expected, 1))
+            break;
+    }
+    if (!slot) {
+        slot = calloc(1, sizeof(*slot));
+        if (!slot)
+            return NULL;
+        atomic_init(&slot->owned, 1);
+        slot->next = atomic_load(&hazard_slots);
+        while (!atomic_compare_exchange_weak(&hazard_slots, &slot->next, slot))
+            ;
+    }
+
+    hazard_mine = slot;
+    pthread_setspecific(hazard_key, slot);
+    return slot;
+}
+
+static int hazard_in_use(const struct PBoxRegionTable* table) {
+    for (struct HazardSlot* s = atomic_load(&hazard_slots); s; s = s->next) {
+        if (atomic_load(&s->table) == table)
+            return 1;
+    }
+    return 0;
+}
+
+// Free retired tables that no reader holds (must hold index->lock)
+static void reclaim(struct PBoxRegionIndex* index) {
+    size_t kept = 0;
+    for (size_t i = 0; i < index->retired_count; i++) {
+        if (hazard_in_use(index->retired[i]))
+            index->retired[kept++] = index->retired[i];
+        else
+            free(index->retired[i]);
+    }
+    index->retired_count = kept;
+}
+
+// Replace the table and retire the old one (must hold index->lock)
+static void publish(struct PBoxRegionIndex* index,
+                    struct PBoxRegionTable* table) {
+    struct PBoxRegionTable* old = atomic_exchange(&index->table, table);
+    if (!old)
+        return;
+
+    if (index->retired_count == index->retired_cap) {
+        size_t cap = index->retired_cap ? index->retired_cap * 2 : 8;
+        struct PBoxRegionTable** retired =
+            realloc(index->retired, cap * sizeof(*retired));
+        if (!retired) {
+            // Nowhere to defer the free to: wait out the readers instead
+            while (hazard_in_use(old))
+                sched_yield();
+            free(old);
+            reclaim(index);
+            return;
+        }
+        index->retired = retired;
+        index->retired_cap = cap;
+    }
+    index->retired[index->retired_count++] = old;
+    reclaim(index);
+}
+
+static int table_contains(const struct PBoxRegionTable* table, uintptr_t addr,
+                          size_t size) {
+    if (!table)
+        return 0;
+
+    // Find the last region starting at or below addr
+    size_t lo = 0, hi = table->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (table->regions[mid].base <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return 0;
+    const struct PBoxRegion* r = &table->regions[lo - 1];
+    return addr - r->base <= r->end - r->base && size <= r->end - addr;
+}
+
+// Build a table from the current one with [base, end) cut out, and added
+// back as one region if insert is set (must hold index->lock)
+static int update(struct PBoxRegionIndex* index, uintptr_t base, uintptr_t end,
+                  int insert) {
+    struct PBoxRegionTable* old = atomic_load(&index->table);
+    size_t old_count = old ? old->count : 0;
+
+    // Cutting can split one region in two, and insert adds one more
+    struct PBoxRegionTable* table =
+        malloc(sizeof(*table) + (old_count + 2) * sizeof(struct PBoxRegion));
+    if (!table)
+        return -1;
+
+    size_t n = 0, pos = 0;
+    for (size_t i = 0; i < old_count; i++) {
+        struct PBoxRegion r = old->regions[i];
+        if (r.end <= base || r.base >= end) {
+            table->regions[n++] = r;
+        } else {
+            if (r.base < base)
+                table->regions[n++] = (struct PBoxRegion){r.base, base};
+            if (r.end > end)
+                table->regions[n++] = (struct PBoxRegion){end, r.end};
+        }
+        if (n && table->regions[n - 1].end <= base)
+            pos = n;
+    }
+    if (insert) {
+        memmove(&table->regions[pos + 1], &table->regions[pos],
+                (n - pos) * sizeof(struct PBoxRegion));
+        table->regions[pos] = (struct PBoxRegion){base, end};
+        n++;
+    }
+    table->count = n;
+
+    publish(index, table);
+    return 0;
+}
+
+void pbox_index_init(struct PBoxRegionIndex* index) {
+    atomic_init(&index->table, NULL);
+    pthread_mutex_init(&index->lock, NULL);
+    index->retired = NULL;
+    index->retired_count = 0;
+    index->retired_cap = 0;
+}
+
+void pbox_index_destroy(struct PBoxRegionIndex* index) {
+    free(atomic_load(&index->table));
+    for (size_t i = 0; i < index->retired_count; i++)
+        free(index->retired[i]);
+    free(index->retired);
+    pthread_mutex_destroy(&index->lock);
+}
+
+int pbox_index_insert(struct PBoxRegionIndex* index, const void* base,
+                      size_t size) {
+    uintptr_t start = (uintptr_t) base;
+    if (size == 0 || start + size < start)
+        return -1;
+    pthread_mutex_lock(&index->lock);
+    int result = update(index, start, start + size, 1);
+    pthread_mutex_unlock(&index->lock);
+    return result;
+}
+
+void pbox_index_remove(struct PBoxRegionIndex* index, const void* base,
+                       size_t size) {
+    uintptr_t start = (uintptr_t) base;
+    uintptr_t end = start + size < start ? UINTPTR_MAX : start + size;
+    pthread_mutex_lock(&index->lock);
+    if (update(index, start, end, 0) < 0) {
+        // Out of memory: forget every region rather than keep a stale one
+        publish(index, NULL);
+    }
+    pthread_mutex_unlock(&index->lock);
+}
+
+int pbox_index_contains(struct PBoxRegionIndex* index, const void* ptr,
+                        size_t size) {
+    struct HazardSlot* slot = hazard_slot();
+    if (!slot) {
+        pthread_mutex_lock(&index->lock);
+        int found =
+            table_contains(atomic_load(&index->table), (uintptr_t) ptr, size);
+        pthread_mutex_unlock(&index->lock);
+        return found;
+    }
+
+    // Announce the table before searching it. Rechecking afterwards
+    // ensures a writer that replaced it will see the announcement.
+    struct PBoxRegionTable* table;
+    do {
+        table = atomic_load(&index->table);
+        atomic_store(&slot->table, table);
+    } while (atomic_load(&index->table) != table);
+
+    int found = table_contains(table, (uintptr_t) ptr, size);
+    atomic_store_explicit(&slot->table, NULL, memory_order_release);
+    return found;
+}
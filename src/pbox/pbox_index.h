@@ -0,0 +1,51 @@
+#pragma once
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Sorted index of identity-mapped regions, used to verify sandbox pointers.
+//
+// Lookups take no lock and write no shared memory: the regions are kept in
+// an immutable sorted table that writers replace wholesale (read-copy-
+// update). A reader announces the table it is searching in a per-thread
+// hazard slot, and a replaced table is only freed once no slot names it.
+
+struct PBoxRegion {
+    uintptr_t base;
+    uintptr_t end;  // Exclusive
+};
+
+struct PBoxRegionTable {
+    size_t count;
+    struct PBoxRegion regions[];  // Sorted by base, non-overlapping
+};
+
+struct PBoxRegionIndex {
+    _Atomic(struct PBoxRegionTable*) table;  // NULL when empty
+    pthread_mutex_t lock;                    // Serializes writers
+    struct PBoxRegionTable** retired;  // Replaced tables still being read
+    size_t retired_count;
+    size_t retired_cap;
+};
+
+void pbox_index_init(struct PBoxRegionIndex* index);
+
+// Free the index. No lookups may be in progress.
+void pbox_index_destroy(struct PBoxRegionIndex* index);
+
+// Add [base, base + size), replacing whatever part of the index it overlaps
+// (a stale entry for memory that was unmapped behind the index's back).
+// Returns 0 on success, -1 if out of memory.
+int pbox_index_insert(struct PBoxRegionIndex* index, const void* base,
+                      size_t size);
+
+// Drop [base, base + size) from the index, trimming or splitting regions
+// that only partly overlap it
+void pbox_index_remove(struct PBoxRegionIndex* index, const void* base,
+                       size_t size);
+
+// Check whether [ptr, ptr + size) lies inside a single indexed region
+int pbox_index_contains(struct PBoxRegionIndex* index, const void* ptr,
+                        size_t size);
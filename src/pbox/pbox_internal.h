@@ -2,10 +2,12 @@
 
 #include "pbox.h"
 
+#include <limits.h>
 #include <linux/futex.h>
 #include <stdatomic.h>
 #include <stdint.h>
 #include <sys/syscall.h>
+#include <time.h>
 #include <unistd.h>
 
 // Channel states
@@ -24,21 +26,81 @@ enum {
     PBOX_REQ_CALL = 2,
     PBOX_REQ_RECV_FD = 3,
     PBOX_REQ_SPAWN_WORKER = 4,
-    PBOX_REQ_CREATE_CLOSURE = 5  // Create ffi_closure in sandbox
+    PBOX_REQ_CREATE_CLOSURE = 5,  // Create ffi_closure in sandbox
+    PBOX_REQ_RING = 6,            // Drain the call ring
+    PBOX_REQ_HEAP_INIT = 7,       // Serve malloc from the shared heap
+    PBOX_REQ_DLSYM_MANY = 8,      // Look up several symbols at once
+    PBOX_REQ_SET_AFFINITY = 9,    // Pin the channel's worker to a CPU
+    PBOX_REQ_SET_SCHED = 10,      // Set the worker's scheduling policy
+    PBOX_REQ_DESCRIBE = 11,       // Classify a call signature once
+    PBOX_REQ_CALL_DESC = 12       // Call with a described signature
+};
+
+// Channel sides, used to index per-side wait bookkeeping
+enum {
+    PBOX_SIDE_HOST = 0,
+    PBOX_SIDE_SANDBOX = 1
 };
 
 #define PBOX_MAX_SYMBOL_NAME 256
-#define PBOX_SPIN_ITERATIONS 0
+#define PBOX_SPIN_DEFAULT_NS 20000  // Default spin cap (multi-core hosts)
+#define PBOX_SPIN_SLACK_NS 1000     // Added to the adaptive spin estimate
+#define PBOX_SPIN_CHECK_EVERY 64    // PAUSEs between clock reads
 #define PBOX_ARG_STORAGE 1024
 #define PBOX_RESULT_STORAGE 32
 #define PBOX_MEM_STORAGE 4096
 #define PBOX_MAX_CLOSURES 64
+#define PBOX_MAX_CALLBACKS 64
+#define PBOX_MAX_CALL_DESCS 128
+#define PBOX_DLSYM_MANY_MAX (PBOX_ARG_STORAGE / sizeof(uint64_t))
+#define PBOX_RECV_FDS_MAX 253  // Fds per message (the kernel's SCM_MAX_FD)
 #define PBOX_IDMEM_DEFAULT_SIZE (1 << 20)  // 1MB default identity region
+#define PBOX_IDMEM_MAX_GROWTH (64 << 20)   // Scratch chunks stop doubling here
+#define PBOX_IDMEM_MIN_BLOCK 16            // Smallest pool size class
+#define PBOX_RING_SLOTS 32                 // Pipelined calls per channel
+#define PBOX_SLOT_ARG_STORAGE (PBOX_MAX_ARGS * sizeof(uint64_t))
+#define PBOX_INLINE_BASE PBOX_SLOT_ARG_STORAGE  // Inline buffers in arg_storage
+#define PBOX_ONEWAY_SLOTS 64               // Queued one-way callbacks
+#define PBOX_CALLBACK_DRAIN (-1)  // callback_id: just run the one-way queue
+
+// One pipelined call in the channel's call ring
+struct PBoxCallSlot {
+    uint64_t func_addr;
+    int nargs;
+    int ret_type;
+    int arg_types[PBOX_MAX_ARGS];
+    // These are offsets into arg_storage.
+    uint64_t args[PBOX_MAX_ARGS];
+    char arg_storage[PBOX_SLOT_ARG_STORAGE];
+    char result_storage[PBOX_RESULT_STORAGE];
+};
+
+// One queued invocation of a one-way callback
+struct PBoxOnewaySlot {
+    int callback_id;
+    // These are offsets into arg_storage.
+    uint64_t args[PBOX_MAX_ARGS];
+    char arg_storage[PBOX_SLOT_ARG_STORAGE];
+};
 
 // Shared memory channel layout
 struct PBoxChannel {
     atomic_int state;
 
+    // Set while the corresponding side is parked in FUTEX_WAIT on state.
+    // pbox_set_state only issues FUTEX_WAKE when someone is parked.
+    atomic_int parked[2];
+
+    // Moving average of each side's recent wait latency in ns, used to size
+    // the spin phase. Only a hint: it is always clamped to the waiter's own
+    // spin cap, so the peer cannot make us spin longer than our policy says.
+    atomic_uint wait_avg_ns[2];
+
+    // Wait policy for the sandbox side (written by the host)
+    atomic_uint sandbox_spin_max_ns;
+    atomic_int sandbox_spin_adaptive;
+    atomic_int sandbox_cpu;  // CPU + 1 for the worker to poll on, 0 if none
+
     // Sandbox's view of this channel's address
     uintptr_t sandbox_channel_addr;
 
@@ -51,13 +113,29 @@ struct PBoxChannel {
     int arg_types[PBOX_MAX_ARGS];
     // These are offsets into arg_storage.
     uint64_t args[PBOX_MAX_ARGS];
+    // Bit i is set if argument i is an inline buffer (see pbox_call_inline):
+    // the host stores the buffer's offset in arg_storage as the argument,
+    // and the sandbox replaces it with a pointer before the call.
+    uint32_t inline_mask;
+
+    // For PBOX_REQ_DESCRIBE (with ret_type, nargs and arg_types) and
+    // PBOX_REQ_CALL_DESC (with func_addr). Described calls take argument i
+    // from arg_storage + 8 * i instead of using args. The sandbox sets it
+    // to -1 if it can't describe the call.
+    int call_desc;
 
     // For PBOX_REQ_DLSYM
     char symbol_name[PBOX_MAX_SYMBOL_NAME];
     uintptr_t symbol_addr;
 
-    // For PBOX_REQ_RECV_FD
-    int received_fd;
+    // For PBOX_REQ_DLSYM_MANY: symbol_count NUL-terminated names packed
+    // into mem_storage. Addresses are returned as uint64_t in arg_storage.
+    int symbol_count;
+
+    // For PBOX_REQ_RECV_FD: fd_count fds arrive in one message. The sandbox
+    // returns them as ints in arg_storage, and sets fd_count to the number
+    // it received, or -1.
+    int fd_count;
 
     // For PBOX_REQ_SPAWN_WORKER
     int worker_shm_fd;  // Sandbox fd of new channel
@@ -67,12 +145,42 @@ struct PBoxChannel {
     int closure_nargs;
     int closure_ret_type;
     int closure_arg_types[PBOX_MAX_ARGS];
+    int closure_oneway;      // Queue invocations instead of waiting
     uintptr_t closure_addr;  // Result: sandbox address of created closure
 
+    // For PBOX_REQ_HEAP_INIT
+    uintptr_t heap_base;
+    uint64_t heap_size;
+
+    // For PBOX_REQ_SET_AFFINITY and PBOX_REQ_SET_SCHED, which the worker
+    // applies to itself
+    int sched_cpu;  // -1 for every CPU
+    int sched_policy;
+    int sched_priority;
+    int sched_result;  // Result: 0, or a negative errno
+
     // For PBOX_STATE_CALLBACK
     int callback_id;
 
-    char arg_storage[PBOX_ARG_STORAGE];
+    // Call ring (PBOX_REQ_RING), a single-producer single-consumer queue.
+    // The host fills slots and advances ring_head; the sandbox runs slots
+    // in order and advances ring_done as each result becomes available.
+    // Slot i lives at ring[i % PBOX_RING_SLOTS].
+    atomic_uint ring_head;
+    atomic_uint ring_done;
+    struct PBoxCallSlot ring[PBOX_RING_SLOTS];
+
+    // One-way callback queue, the call ring's counterpart in the other
+    // direction. The sandbox appends invocations and advances oneway_head
+    // without waiting; the host runs them in order and advances
+    // oneway_done. The host drains it before each synchronous callback and
+    // when the enclosing call completes. A sandbox that finds it full asks
+    // for a drain with a PBOX_CALLBACK_DRAIN callback.
+    atomic_uint oneway_head;
+    atomic_uint oneway_done;
+    struct PBoxOnewaySlot oneway[PBOX_ONEWAY_SLOTS];
+
+    _Alignas(16) char arg_storage[PBOX_ARG_STORAGE];
     char result_storage[PBOX_RESULT_STORAGE];
     char mem_storage[PBOX_MEM_STORAGE];
 };
@@ -95,20 +203,155 @@ static inline int pbox_futex_wake(atomic_int* addr) {
     return syscall(SYS_futex, addr, FUTEX_WAKE, 1, NULL, NULL, 0);
 }
 
-// Hybrid spin-then-wait
-static inline void pbox_wait_for_state(atomic_int* addr, int expected) {
-    for (int i = 0; i < PBOX_SPIN_ITERATIONS; i++) {
-        if (atomic_load(addr) == expected)
-            return;
-        PAUSE();
+static inline int pbox_futex_wake_all(atomic_int* addr) {
+    return syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static inline uint64_t pbox_now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+// Fold a wait latency sample into the side's moving average (1/8 weight).
+// Samples are clamped to a few times the spin cap: anything longer just
+// means "too slow to spin for", and clamping keeps recovery after a long
+// idle period quick.
+static inline void pbox_record_wait(struct PBoxChannel* ch, int side,
+                                    uint32_t spin_max_ns, uint64_t sample) {
+    uint64_t limit = (uint64_t) spin_max_ns * 4;
+    if (sample > limit)
+        sample = limit;
+    int64_t avg = atomic_load_explicit(&ch->wait_avg_ns[side],
+                                       memory_order_relaxed);
+    avg += ((int64_t) sample - avg) / 8;
+    atomic_store_explicit(&ch->wait_avg_ns[side], (unsigned) avg,
+                          memory_order_relaxed);
+}
+
+// Wait until the channel leaves state `current` and return the new state.
+//
+// Spins first (with PAUSE) for a budget derived from the policy, then
+// advertises itself as parked and sleeps in FUTEX_WAIT. In adaptive mode
+// the budget is about twice the recently observed latency, or zero when
+// that would exceed the cap (long calls are not worth spinning for).
+static inline int pbox_wait_for_change(struct PBoxChannel* ch, int side,
+                                       struct PBoxWaitPolicy policy,
+                                       int current) {
+    int state = atomic_load(&ch->state);
+    if (state != current)
+        return state;
+
+    uint64_t start = 0;
+    if (policy.spin_max_ns > 0) {
+        uint32_t budget = policy.spin_max_ns;
+        if (policy.adaptive) {
+            uint32_t avg = atomic_load_explicit(&ch->wait_avg_ns[side],
+                                                memory_order_relaxed);
+            budget = avg <= policy.spin_max_ns / 2
+                         ? 2 * avg + PBOX_SPIN_SLACK_NS
+                         : 0;
+        }
+
+        start = pbox_now_ns();
+        while (budget > 0) {
+            for (int i = 0; i < PBOX_SPIN_CHECK_EVERY; i++) {
+                PAUSE();
+                state = atomic_load(&ch->state);
+                if (state != current)
+                    goto done;
+            }
+            if (pbox_now_ns() - start >= budget)
+                break;
+        }
     }
-    int current;
-    while ((current = atomic_load(addr)) != expected) {
-        pbox_futex_wait(addr, current);
+
+    // Advertise before re-checking state so that a concurrent
+    // pbox_set_state either sees us parked or we see its new state.
+    atomic_store(&ch->parked[side], 1);
+    while ((state = atomic_load(&ch->state)) == current) {
+        pbox_futex_wait(&ch->state, current);
+    }
+    atomic_store(&ch->parked[side], 0);
+
+done:
+    if (policy.spin_max_ns > 0 && policy.adaptive)
+        pbox_record_wait(ch, side, policy.spin_max_ns, pbox_now_ns() - start);
+    return state;
+}
+
+static inline void pbox_wait_for_state(struct PBoxChannel* ch, int side,
+                                       struct PBoxWaitPolicy policy,
+                                       int expected) {
+    int state = atomic_load(&ch->state);
+    while (state != expected) {
+        state = pbox_wait_for_change(ch, side, policy, state);
     }
 }
 
-static inline void pbox_set_state(atomic_int* addr, int value) {
-    atomic_store(addr, value);
-    pbox_futex_wake(addr);
+// Wait policy for the sandbox side of a channel, as set by the host
+static inline struct PBoxWaitPolicy pbox_sandbox_policy(
+    struct PBoxChannel* ch) {
+    struct PBoxWaitPolicy policy = {
+        .spin_max_ns = atomic_load_explicit(&ch->sandbox_spin_max_ns,
+                                            memory_order_relaxed),
+        .adaptive = atomic_load_explicit(&ch->sandbox_spin_adaptive,
+                                         memory_order_relaxed),
+    };
+    return policy;
+}
+
+static inline void pbox_set_state(struct PBoxChannel* ch, int value) {
+    atomic_store(&ch->state, value);
+    // Skip the syscall when both sides are spinning (or running).
+    if (atomic_load(&ch->parked[PBOX_SIDE_HOST]) ||
+        atomic_load(&ch->parked[PBOX_SIDE_SANDBOX]))
+        pbox_futex_wake(&ch->state);
 }
+
+// Host side: pbox_dlsym_many on the control channel, so the calling thread
+// does not get a worker channel of its own (used by the sandbox pool)
+size_t pbox_dlsym_many_control(struct PBox* box, const char* const* symbols,
+                               size_t count, void** addrs);
+
+// Host side: start path with argv without forking the host. The child
+// shares our memory until it execs, so the cost does not grow with the
+// host's size. Only keep_fds survive the exec. Returns the pid and stores
+// a pidfd for it in *pidfd, or returns -1 with errno set if the child could
+// not be created or the exec failed.
+pid_t pbox_spawn(const char* path, char* const* argv, const int* keep_fds,
+                 size_t keep_count, int* pidfd);
+
+// A process watched by the reaper (see pbox_reaper_watch)
+struct PBoxWatch {
+    int pidfd;
+    pid_t pid;
+    int reap;  // Our child, so collect its exit status
+    // Called on the reaper thread once the process has exited, with its
+    // wait status, or -1 if it was not ours to collect
+    void (*exited)(struct PBoxWatch* watch, int status);
+    void* arg;
+    atomic_int done;  // Set once exited has returned
+};
+
+// Host side: have the process-wide reaper thread call watch->exited when
+// the process exits. One thread watches every sandbox, through an epoll set
+// of their pidfds. Returns 0 on success, -1 on failure.
+int pbox_reaper_watch(struct PBoxWatch* watch);
+
+// Host side: wait until watch->exited has returned. The watch may be freed
+// afterwards.
+void pbox_reaper_wait(struct PBoxWatch* watch);
+
+// Host side: have the zygote fork a sandbox serving the control channel in
+// shm_fd and receiving fds on sock_fd. Returns its pid and stores a pidfd
+// for it in *pidfd, or returns -1 on failure.
+pid_t pbox_zygote_spawn(struct PBoxZygote* zygote, int shm_fd, int sock_fd,
+                        int* pidfd);
+
+// Host side: symbol addresses shared by all the zygote's sandboxes.
+// get returns 1 and fills addrs if count addresses were stored before.
+int pbox_zygote_get_syms(struct PBoxZygote* zygote, void** addrs,
+                         size_t count);
+void pbox_zygote_put_syms(struct PBoxZygote* zygote, void* const* addrs,
+                          size_t count);
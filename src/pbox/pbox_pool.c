@@ -0,0 +1,268 @@
+#define _GNU_SOURCE
+
+#include "pbox.h"
+#include "pbox_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define PBOX_POOL_RETRY_NS 100000000  // Wait after a failed create: 100ms
+
+// A ready sandbox and its resolved symbols
+struct PBoxPoolEntry {
+    struct PBox* box;
+    void** addrs;  // symbol_count entries, or NULL if there are no symbols
+};
+
+struct PBoxPool {
+    char* executable;
+    struct PBoxOptions options;
+    int has_options;
+    char** symbols;
+    size_t symbol_count;
+    void** zygote_addrs;  // Symbols as resolved in the first zygote child
+
+    pthread_mutex_t lock;
+    pthread_cond_t cond;  // Signaled when the worker has something to do
+    struct PBoxPoolEntry* ready;
+    size_t ready_count;
+    size_t size;
+    struct PBox** retired;  // Waiting to be destroyed
+    size_t retired_count;
+    size_t retired_cap;
+    int stop;
+    pthread_t worker;
+};
+
+// Create a sandbox and resolve the pool's symbols in it. Returns an entry
+// with a NULL box on failure.
+static struct PBoxPoolEntry pool_warm(struct PBoxPool* pool) {
+    struct PBoxPoolEntry entry = {NULL, NULL};
+    if (pool->symbol_count > 0) {
+        entry.addrs = malloc(pool->symbol_count * sizeof(void*));
+        if (!entry.addrs)
+            return entry;
+    }
+
+    entry.box = pbox_create_with_options(
+        pool->executable, pool->has_options ? &pool->options : NULL);
+    if (!entry.box) {
+        free(entry.addrs);
+        entry.addrs = NULL;
+        return entry;
+    }
+    if (pool->symbol_count == 0)
+        return entry;
+
+    // A zygote's children all have the same symbol addresses
+    struct PBoxZygote* zygote = pool->has_options ? pool->options.zygote : NULL;
+    pthread_mutex_lock(&pool->lock);
+    void** cached = pool->zygote_addrs;
+    if (cached)
+        memcpy(entry.addrs, cached, pool->symbol_count * sizeof(void*));
+    pthread_mutex_unlock(&pool->lock);
+    if (cached)
+        return entry;
+
+    pbox_dlsym_many_control(entry.box, (const char* const*) pool->symbols,
+                            pool->symbol_count, entry.addrs);
+    if (zygote && pbox_alive(entry.box)) {
+        void** addrs = malloc(pool->symbol_count * sizeof(void*));
+        if (addrs)
+            memcpy(addrs, entry.addrs, pool->symbol_count * sizeof(void*));
+        pthread_mutex_lock(&pool->lock);
+        if (!pool->zygote_addrs) {
+            pool->zygote_addrs = addrs;
+            addrs = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+        free(addrs);
+    }
+    return entry;
+}
+
+// Queue a sandbox for destruction (must hold pool->lock). Returns -1 if
+// out of memory, in which case the caller destroys it.
+static int pool_queue_retired(struct PBoxPool* pool, struct PBox* box) {
+    if (pool->retired_count == pool->retired_cap) {
+        size_t cap = pool->retired_cap ? pool->retired_cap * 2 : 8;
+        struct PBox** retired =
+            realloc(pool->retired, cap * sizeof(*retired));
+        if (!retired)
+            return -1;
+        pool->retired = retired;
+        pool->retired_cap = cap;
+    }
+    pool->retired[pool->retired_count++] = box;
+    pthread_cond_signal(&pool->cond);
+    return 0;
+}
+
+// Keep the pool full and destroy retired sandboxes. Refilling comes first,
+// since an empty pool makes acquire create sandboxes synchronously.
+static void* pool_worker_fn(void* arg) {
+    struct PBoxPool* pool = arg;
+    pthread_mutex_lock(&pool->lock);
+    while (!pool->stop) {
+        if (pool->ready_count < pool->size) {
+            pthread_mutex_unlock(&pool->lock);
+            struct PBoxPoolEntry entry = pool_warm(pool);
+            pthread_mutex_lock(&pool->lock);
+            if (entry.box) {
+                pool->ready[pool->ready_count++] = entry;
+                continue;
+            }
+
+            // Don't spin on an executable that keeps failing to start
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += PBOX_POOL_RETRY_NS;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            int err = 0;
+            while (!pool->stop && !pool->retired_count && err != ETIMEDOUT)
+                err = pthread_cond_timedwait(&pool->cond, &pool->lock,
+                                             &deadline);
+        }
+        if (pool->retired_count > 0) {
+            struct PBox* box = pool->retired[--pool->retired_count];
+            pthread_mutex_unlock(&pool->lock);
+            pbox_destroy(box);
+            pthread_mutex_lock(&pool->lock);
+            continue;
+        }
+        if (pool->ready_count >= pool->size && !pool->stop)
+            pthread_cond_wait(&pool->cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+static void pool_free(struct PBoxPool* pool) {
+    for (size_t i = 0; i < pool->symbol_count; i++)
+        free(pool->symbols[i]);
+    free(pool->symbols);
+    free(pool->zygote_addrs);
+    free(pool->ready);
+    free(pool->retired);
+    free(pool->executable);
+    free(pool);
+}
+
+struct PBoxPool* pbox_pool_create(const char* sandbox_executable, size_t size,
+                                  const struct PBoxOptions* options,
+                                  const char* const* symbols,
+                                  size_t symbol_count) {
+    struct PBoxPool* pool = calloc(1, sizeof(struct PBoxPool));
+    if (!pool)
+        return NULL;
+
+    pool->executable = strdup(sandbox_executable);
+    pool->ready = calloc(size ? size : 1, sizeof(struct PBoxPoolEntry));
+    pool->symbols = symbol_count ? calloc(symbol_count, sizeof(char*)) : NULL;
+    if (!pool->executable || !pool->ready ||
+        (symbol_count && !pool->symbols)) {
+        pool_free(pool);
+        return NULL;
+    }
+    for (size_t i = 0; i < symbol_count; i++) {
+        pool->symbols[i] = strdup(symbols[i]);
+        if (!pool->symbols[i]) {
+            pool->symbol_count = i;
+            pool_free(pool);
+            return NULL;
+        }
+    }
+    pool->symbol_count = symbol_count;
+    if (options) {
+        pool->options = *options;
+        pool->has_options = 1;
+    }
+    pool->size = size;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    if (pthread_create(&pool->worker, NULL, pool_worker_fn, pool) != 0) {
+        perror("pbox: pthread_create");
+        pthread_cond_destroy(&pool->cond);
+        pthread_mutex_destroy(&pool->lock);
+        pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+struct PBox* pbox_pool_acquire(struct PBoxPool* pool, void** addrs) {
+    struct PBoxPoolEntry entry = {NULL, NULL};
+    pthread_mutex_lock(&pool->lock);
+    while (pool->ready_count > 0) {
+        // Oldest first, since it is the likeliest to have died meanwhile
+        struct PBoxPoolEntry e = pool->ready[0];
+        memmove(&pool->ready[0], &pool->ready[1],
+                --pool->ready_count * sizeof(struct PBoxPoolEntry));
+        pthread_cond_signal(&pool->cond);
+        if (pbox_alive(e.box)) {
+            entry = e;
+            break;
+        }
+        free(e.addrs);
+        if (pool_queue_retired(pool, e.box) < 0) {
+            pthread_mutex_unlock(&pool->lock);
+            pbox_destroy(e.box);
+            pthread_mutex_lock(&pool->lock);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!entry.box) {
+        entry = pool_warm(pool);
+        if (!entry.box)
+            return NULL;
+    }
+    if (addrs && pool->symbol_count > 0)
+        memcpy(addrs, entry.addrs, pool->symbol_count * sizeof(void*));
+    free(entry.addrs);
+    return entry.box;
+}
+
+void pbox_pool_retire(struct PBoxPool* pool, struct PBox* box) {
+    if (!box)
+        return;
+    pthread_mutex_lock(&pool->lock);
+    int queued = pool_queue_retired(pool, box);
+    pthread_mutex_unlock(&pool->lock);
+    if (queued < 0)
+        pbox_destroy(box);
+}
+
+size_t pbox_pool_ready(struct PBoxPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    size_t count = pool->ready_count;
+    pthread_mutex_unlock(&pool->lock);
+    return count;
+}
+
+void pbox_pool_destroy(struct PBoxPool* pool) {
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_signal(&pool->cond);
+    pthread_mutex_unlock(&pool->lock);
+    pthread_join(pool->worker, NULL);
+
+    for (size_t i = 0; i < pool->ready_count; i++) {
+        pbox_destroy(pool->ready[i].box);
+        free(pool->ready[i].addrs);
+    }
+    for (size_t i = 0; i < pool->retired_count; i++)
+        pbox_destroy(pool->retired[i]);
+
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+    pool_free(pool);
+}
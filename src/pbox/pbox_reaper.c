@@ -0,0 +1,78 @@
+#define _GNU_SOURCE
+
+#include "pbox_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+
+#define PBOX_REAPER_BATCH 64  // Exits handled per epoll_wait
+
+// One thread for every sandbox in the process, started with the first. It
+// never exits: there is no point at which no more sandboxes can be created.
+static int reaper_epfd = -1;
+static pthread_once_t reaper_once = PTHREAD_ONCE_INIT;
+
+static void* reaper_thread_fn(void* arg) {
+    (void) arg;
+    struct epoll_event events[PBOX_REAPER_BATCH];
+    for (;;) {
+        int n = epoll_wait(reaper_epfd, events, PBOX_REAPER_BATCH, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("pbox: epoll_wait");
+            return NULL;
+        }
+        for (int i = 0; i < n; i++) {
+            struct PBoxWatch* watch = events[i].data.ptr;
+            epoll_ctl(reaper_epfd, EPOLL_CTL_DEL, watch->pidfd, NULL);
+
+            int status = -1;
+            if (watch->reap)
+                waitpid(watch->pid, &status, 0);
+            watch->exited(watch, status);
+
+            // The watch may be freed as soon as this is seen
+            atomic_store(&watch->done, 1);
+            pbox_futex_wake_all(&watch->done);
+        }
+    }
+}
+
+static void reaper_start(void) {
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("pbox: epoll_create1");
+        return;
+    }
+    reaper_epfd = epfd;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reaper_thread_fn, NULL) != 0) {
+        perror("pbox: pthread_create");
+        close(epfd);
+        reaper_epfd = -1;
+        return;
+    }
+    pthread_detach(thread);
+}
+
+int pbox_reaper_watch(struct PBoxWatch* watch) {
+    pthread_once(&reaper_once, reaper_start);
+    if (reaper_epfd < 0)
+        return -1;
+
+    atomic_init(&watch->done, 0);
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = watch};
+    if (epoll_ctl(reaper_epfd, EPOLL_CTL_ADD, watch->pidfd, &ev) < 0) {
+        perror("pbox: epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void pbox_reaper_wait(struct PBoxWatch* watch) {
+    while (!atomic_load(&watch->done))
+        pbox_futex_wait(&watch->done, 0);
+}
@@ -1,16 +1,25 @@
+#define _GNU_SOURCE
+
+#include "pbox_heap.h"
 #include "pbox_internal.h"
 #include "pbox_seccomp.h"
 
 #include <assert.h>
 #include <dlfcn.h>
+#include <errno.h>
 #include "dyfn.h"
 #include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 // Global socket fd for fd passing (shared by all workers)
 static int g_sock_fd;
@@ -18,53 +27,181 @@ static int g_sock_fd;
 // Thread-local storage for current channel (used by callback closures)
 static __thread struct PBoxChannel* tls_current_channel = NULL;
 
-#ifndef SBOX_NO_CALLBACKS
+// Shared heap, set up by the host with PBOX_REQ_HEAP_INIT. The sandbox's
+// malloc serves from it so that the host can allocate and access the same
+// objects without a round trip. Before it is set up, and whenever it cannot
+// satisfy a request, allocations fall through to the libc allocator.
+static struct PBoxHeap g_heap;
+static atomic_int g_heap_ready;
 
-// Called by assembly closure common handler.
-// Extracts args from saved registers, signals host, returns result.
-void dyfn_closure_dispatch(struct DyfnClosureSavedRegs* saved,
-                           struct DyfnClosureResult* result) {
-    struct DyfnClosureInfo* info =
-        &dyfn_closure_info[saved->stub_index];
-    struct PBoxChannel* ch = tls_current_channel;
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t nmemb, size_t size);
+extern void* __libc_realloc(void* ptr, size_t size);
+extern void __libc_free(void* ptr);
 
-    if (!ch)
+static const struct PBoxHeap* shared_heap(void) {
+    if (!atomic_load_explicit(&g_heap_ready, memory_order_acquire))
+        return NULL;
+    return &g_heap;
+}
+
+void* malloc(size_t size) {
+    const struct PBoxHeap* heap = shared_heap();
+    if (heap) {
+        void* p = pbox_heap_alloc(heap, size, 0);
+        if (p)
+            return p;
+    }
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t nmemb, size_t size) {
+    const struct PBoxHeap* heap = shared_heap();
+    size_t total;
+    if (heap && !__builtin_mul_overflow(nmemb, size, &total)) {
+        void* p = pbox_heap_alloc(heap, total, 0);
+        if (p) {
+            memset(p, 0, total);
+            return p;
+        }
+    }
+    return __libc_calloc(nmemb, size);
+}
+
+void free(void* ptr) {
+    const struct PBoxHeap* heap = shared_heap();
+    if (heap && pbox_heap_contains(heap, ptr, 1)) {
+        pbox_heap_free(heap, ptr, 0);
         return;
+    }
+    __libc_free(ptr);
+}
 
-    ch->callback_id = info->callback_id;
-    ch->nargs = info->nargs;
+void* realloc(void* ptr, size_t size) {
+    const struct PBoxHeap* heap = shared_heap();
+    if (!ptr)
+        return malloc(size);
+    if (!heap || !pbox_heap_contains(heap, ptr, 1))
+        return __libc_realloc(ptr, size);
+
+    size_t usable = pbox_heap_usable_size(heap, ptr);
+    if (size <= usable)
+        return ptr;
+    void* p = malloc(size);
+    if (!p)
+        return NULL;
+    memcpy(p, ptr, usable);
+    free(ptr);
+    return p;
+}
 
-    // Extract args from saved registers using type info.
-    // Args beyond the register file spill into stack_args in declaration order.
+// libc's own reallocarray and malloc_usable_size don't know about heap
+// blocks, so they are replaced too.
+void* reallocarray(void* ptr, size_t nmemb, size_t size) {
+    size_t total;
+    if (__builtin_mul_overflow(nmemb, size, &total)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, total);
+}
+
+size_t malloc_usable_size(void* ptr) {
+    static size_t (*libc_usable_size)(void*);
+
+    const struct PBoxHeap* heap = shared_heap();
+    if (heap && pbox_heap_contains(heap, ptr, 1))
+        return pbox_heap_usable_size(heap, ptr);
+    if (!libc_usable_size)
+        libc_usable_size = (size_t (*)(void*)) dlsym(RTLD_NEXT,
+                                                     "malloc_usable_size");
+    return libc_usable_size ? libc_usable_size(ptr) : 0;
+}
+
+#ifndef SBOX_NO_CALLBACKS
+
+// Callbacks registered as one-way, by callback id (set at closure creation)
+static atomic_bool g_oneway[PBOX_MAX_CALLBACKS];
+
+// Extract args from saved registers using type info.
+// Args beyond the register file spill into stack_args in declaration order.
+static void extract_args(const struct DyfnClosureInfo* info,
+                         const struct DyfnClosureSavedRegs* saved,
+                         uint64_t* args, char* storage) {
     int int_idx = 0, float_idx = 0, stack_idx = 0;
     size_t offset = 0;
     for (int i = 0; i < info->nargs; i++) {
         enum DyfnClass cls = dyfn_classify(info->arg_types[i]);
         size_t size = dyfn_type_size(info->arg_types[i]);
-        ch->args[i] = offset;
+        args[i] = offset;
         if (cls == DYFN_CLASS_FLOAT || cls == DYFN_CLASS_DOUBLE) {
             if (float_idx < DYFN_FLOAT_ARG_REGS)
-                memcpy(&ch->arg_storage[offset],
-                       &saved->float_regs[float_idx++], size);
+                memcpy(&storage[offset], &saved->float_regs[float_idx++],
+                       size);
             else
-                memcpy(&ch->arg_storage[offset],
-                       &saved->stack_args[stack_idx++], size);
+                memcpy(&storage[offset], &saved->stack_args[stack_idx++],
+                       size);
         } else {
             if (int_idx < DYFN_INT_ARG_REGS)
-                memcpy(&ch->arg_storage[offset],
-                       &saved->int_regs[int_idx++], size);
+                memcpy(&storage[offset], &saved->int_regs[int_idx++], size);
             else
-                memcpy(&ch->arg_storage[offset],
-                       &saved->stack_args[stack_idx++], size);
+                memcpy(&storage[offset], &saved->stack_args[stack_idx++],
+                       size);
         }
         offset += size;
     }
+}
+
+// Queue a one-way callback for the host and return without waiting
+static void queue_oneway(struct PBoxChannel* ch,
+                         const struct DyfnClosureInfo* info,
+                         const struct DyfnClosureSavedRegs* saved) {
+    unsigned head = atomic_load_explicit(&ch->oneway_head,
+                                         memory_order_relaxed);
+    if (head - atomic_load_explicit(&ch->oneway_done, memory_order_acquire) >=
+        PBOX_ONEWAY_SLOTS) {
+        // Full: wait for the host to run what is queued
+        ch->callback_id = PBOX_CALLBACK_DRAIN;
+        pbox_set_state(ch, PBOX_STATE_CALLBACK);
+        pbox_wait_for_state(ch, PBOX_SIDE_SANDBOX, pbox_sandbox_policy(ch),
+                            PBOX_STATE_REQUEST);
+    }
+
+    struct PBoxOnewaySlot* slot = &ch->oneway[head % PBOX_ONEWAY_SLOTS];
+    slot->callback_id = info->callback_id;
+    extract_args(info, saved, slot->args, slot->arg_storage);
+    atomic_store_explicit(&ch->oneway_head, head + 1, memory_order_release);
+}
+
+// Called by assembly closure common handler.
+// Extracts args from saved registers, signals host, returns result.
+void dyfn_closure_dispatch(struct DyfnClosureSavedRegs* saved,
+                           struct DyfnClosureResult* result) {
+    struct DyfnClosureInfo* info =
+        &dyfn_closure_info[saved->stub_index];
+    struct PBoxChannel* ch = tls_current_channel;
+
+    if (!ch)
+        return;
+
+    if (info->callback_id >= 0 && info->callback_id < PBOX_MAX_CALLBACKS &&
+        atomic_load_explicit(&g_oneway[info->callback_id],
+                             memory_order_relaxed)) {
+        queue_oneway(ch, info, saved);
+        result->ret_class = DYFN_CLASS_VOID;
+        return;
+    }
+
+    ch->callback_id = info->callback_id;
+    ch->nargs = info->nargs;
+    extract_args(info, saved, ch->args, ch->arg_storage);
 
     // Signal callback to host
-    pbox_set_state(&ch->state, PBOX_STATE_CALLBACK);
+    pbox_set_state(ch, PBOX_STATE_CALLBACK);
 
     // Wait for host to complete
-    pbox_wait_for_state(&ch->state, PBOX_STATE_REQUEST);
+    pbox_wait_for_state(ch, PBOX_SIDE_SANDBOX, pbox_sandbox_policy(ch),
+                        PBOX_STATE_REQUEST);
 
     // Copy result back
     result->ret_class = dyfn_classify(info->ret_type);
@@ -77,19 +214,28 @@ void dyfn_closure_dispatch(struct DyfnClosureSavedRegs* saved,
 }
 #endif // SBOX_NO_CALLBACKS
 
-// Receive a file descriptor over a Unix socket
-static int recv_fd(int sock_fd) {
+// Receive up to max file descriptors sent in one message over a Unix
+// socket. Returns the number received, or -1.
+static int recv_fds(int sock_fd, int* fds, int max) {
+    _Static_assert(PBOX_RECV_FDS_MAX * sizeof(int) <= PBOX_ARG_STORAGE,
+                   "received fds must fit in arg_storage");
     struct msghdr msg = {0};
     struct iovec iov;
     char buf[1];
-    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+    union {
+        char buf[CMSG_SPACE(PBOX_RECV_FDS_MAX * sizeof(int))];
+        struct cmsghdr align;
+    } cmsg_buf;
+
+    if (max < 1 || max > PBOX_RECV_FDS_MAX)
+        return -1;
 
     iov.iov_base = buf;
     iov.iov_len = sizeof(buf);
     msg.msg_iov = &iov;
     msg.msg_iovlen = 1;
-    msg.msg_control = cmsg_buf;
-    msg.msg_controllen = sizeof(cmsg_buf);
+    msg.msg_control = cmsg_buf.buf;
+    msg.msg_controllen = CMSG_SPACE(max * sizeof(int));
 
     if (recvmsg(sock_fd, &msg, 0) < 0)
         return -1;
@@ -99,35 +245,117 @@ static int recv_fd(int sock_fd) {
         cmsg->cmsg_type != SCM_RIGHTS)
         return -1;
 
-    int fd;
-    memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
-    return fd;
+    int count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    memcpy(fds, CMSG_DATA(cmsg), count * sizeof(int));
+    return count;
 }
 
-// Perform a dynamic function call
-static bool do_ffi_call(struct PBoxChannel* ch) {
+// Perform a dynamic function call. arg_offsets index into arg_storage,
+// which holds storage_size bytes.
+static bool do_ffi_call(uint64_t func_addr, int ret_type, int nargs,
+                        const int* arg_types, const uint64_t* arg_offsets,
+                        char* arg_storage, size_t storage_size,
+                        char* result_storage) {
     _Static_assert(PBOX_MAX_ARGS * sizeof(uint64_t) <= PBOX_ARG_STORAGE,
                    "arg_storage too small for max args");
 
+    if (nargs < 0 || nargs > PBOX_MAX_ARGS)
+        return false;
+
     void* arg_values[PBOX_MAX_ARGS];
-    for (int i = 0; i < ch->nargs; i++) {
-        assert(ch->args[i] < PBOX_ARG_STORAGE);
-        arg_values[i] = &ch->arg_storage[ch->args[i]];
+    for (int i = 0; i < nargs; i++) {
+        assert(arg_offsets[i] < storage_size);
+        arg_values[i] = &arg_storage[arg_offsets[i]];
     }
 
     struct DyfnCallArgs call;
-    dyfn_prep_call(&call, (void*) (uintptr_t) ch->func_addr,
-                        (enum DyfnType) ch->ret_type, ch->nargs,
-                        (const enum DyfnType*) ch->arg_types, arg_values);
+    dyfn_prep_call(&call, (void*) (uintptr_t) func_addr,
+                        (enum DyfnType) ret_type, nargs,
+                        (const enum DyfnType*) arg_types, arg_values);
 
     struct DyfnCallResult result;
     dyfn_call(&call, &result);
 
-    dyfn_store_result(&result, (enum DyfnType) ch->ret_type,
-                           ch->result_storage);
+    dyfn_store_result(&result, (enum DyfnType) ret_type, result_storage);
+    return true;
+}
+
+// Point inline buffer arguments at their copies in the channel. The host
+// leaves each one's offset into arg_storage where the pointer goes.
+static void resolve_inline(struct PBoxChannel* ch) {
+    uint32_t mask = ch->inline_mask;
+    for (int i = 0; mask && i < PBOX_MAX_ARGS; i++) {
+        if (!(mask & (1u << i)))
+            continue;
+        mask &= ~(1u << i);
+        uint64_t slot = ch->args[i];
+        if (slot > PBOX_ARG_STORAGE - sizeof(uintptr_t))
+            continue;
+        uintptr_t offset;
+        memcpy(&offset, &ch->arg_storage[slot], sizeof(offset));
+        uintptr_t ptr =
+            offset < PBOX_ARG_STORAGE ? (uintptr_t) &ch->arg_storage[offset]
+                                      : 0;
+        memcpy(&ch->arg_storage[slot], &ptr, sizeof(ptr));
+    }
+}
+
+// Signatures described by the host, by descriptor id. Shared by all workers:
+// a descriptor is described once and then used on any channel.
+static struct DyfnCallPlan g_call_plans[PBOX_MAX_CALL_DESCS];
+static atomic_bool g_call_plan_ready[PBOX_MAX_CALL_DESCS];
+
+// Returns false if the signature can't be called this way
+static bool describe_call(int desc, int ret_type, int nargs,
+                          const int* arg_types) {
+    if (desc < 0 || desc >= PBOX_MAX_CALL_DESCS)
+        return false;
+    if (atomic_load_explicit(&g_call_plan_ready[desc], memory_order_relaxed))
+        return true;
+    if (!dyfn_plan(&g_call_plans[desc], (enum DyfnType) ret_type, nargs,
+                   (const enum DyfnType*) arg_types))
+        return false;
+    atomic_store_explicit(&g_call_plan_ready[desc], true,
+                          memory_order_release);
     return true;
 }
 
+// Perform a call with a described signature. Argument i is at
+// arg_storage + 8 * i.
+static bool do_desc_call(int desc, uint64_t func_addr,
+                         const char* arg_storage, char* result_storage) {
+    if (desc < 0 || desc >= PBOX_MAX_CALL_DESCS ||
+        !atomic_load_explicit(&g_call_plan_ready[desc], memory_order_acquire))
+        return false;
+
+    const struct DyfnCallPlan* plan = &g_call_plans[desc];
+    struct DyfnCallArgs call;
+    dyfn_prep_planned(&call, plan, (void*) (uintptr_t) func_addr,
+                      arg_storage);
+
+    struct DyfnCallResult result;
+    dyfn_call(&call, &result);
+
+    dyfn_store_result(&result, plan->ret_type, result_storage);
+    return true;
+}
+
+// Run every submitted slot of the call ring, including slots the host adds
+// while we are draining, so a stream of calls is served in one wakeup.
+static void drain_ring(struct PBoxChannel* ch) {
+    unsigned done = atomic_load_explicit(&ch->ring_done, memory_order_relaxed);
+    while (done != atomic_load_explicit(&ch->ring_head,
+                                        memory_order_acquire)) {
+        struct PBoxCallSlot* slot = &ch->ring[done % PBOX_RING_SLOTS];
+        if (!do_ffi_call(slot->func_addr, slot->ret_type, slot->nargs,
+                         slot->arg_types, slot->args, slot->arg_storage,
+                         sizeof(slot->arg_storage), slot->result_storage)) {
+            fprintf(stderr, "pbox: ffi call failed\n");
+        }
+        atomic_store_explicit(&ch->ring_done, ++done, memory_order_release);
+    }
+}
+
 // Forward declaration
 static void dispatch_loop(struct PBoxChannel* ch, bool is_control);
 
@@ -174,17 +402,38 @@ int pbox_spawn_worker(int shm_fd) {
     return 0;
 }
 
+// Pin the calling thread to cpu, or let it run anywhere if cpu is -1.
+// Returns 0 or a negative errno.
+static int pin_self(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (int i = 0; i < CPU_SETSIZE; i++) {
+        if (cpu < 0 || i == cpu)
+            CPU_SET(i, &cpus);
+    }
+    return sched_setaffinity(0, sizeof(cpus), &cpus) < 0 ? -errno : 0;
+}
+
 // Main dispatch loop - handles requests until EXIT state
 static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
     tls_current_channel = ch;
 #ifndef SBOX_NO_CALLBACKS
     dyfn_closure_free_all();
 #endif
+    int polling_cpu = 0;  // sandbox_cpu as last applied
 
     while (1) {
+        // Move to the CPU the host picked for busy-polling, if it changed
+        int cpu = atomic_load_explicit(&ch->sandbox_cpu, memory_order_relaxed);
+        if (cpu != polling_cpu) {
+            pin_self(cpu - 1);
+            polling_cpu = cpu;
+        }
+
         // Wait for a request (or exit signal)
+        struct PBoxWaitPolicy policy = pbox_sandbox_policy(ch);
+        int state = atomic_load(&ch->state);
         while (1) {
-            int state = atomic_load(&ch->state);
             if (state == PBOX_STATE_REQUEST)
                 break;
             if (state == PBOX_STATE_EXIT) {
@@ -193,7 +442,7 @@ static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
 #endif
                 return;
             }
-            pbox_futex_wait(&ch->state, state);
+            state = pbox_wait_for_change(ch, PBOX_SIDE_SANDBOX, policy, state);
         }
 
         // Dispatch based on request type
@@ -204,15 +453,52 @@ static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
                 ch->symbol_addr = (uintptr_t) sym;
                 break;
             }
+            case PBOX_REQ_DLSYM_MANY: {
+                ch->mem_storage[PBOX_MEM_STORAGE - 1] = '\0';
+                int count = ch->symbol_count;
+                if (count < 0 || (size_t) count > PBOX_DLSYM_MANY_MAX)
+                    count = 0;
+                uint64_t* addrs = (uint64_t*) ch->arg_storage;
+                const char* name = ch->mem_storage;
+                const char* end = ch->mem_storage + PBOX_MEM_STORAGE;
+                for (int i = 0; i < count; i++) {
+                    if (name < end) {
+                        addrs[i] = (uintptr_t) dlsym(RTLD_DEFAULT, name);
+                        name += strlen(name) + 1;
+                    } else {
+                        addrs[i] = 0;
+                    }
+                }
+                break;
+            }
             case PBOX_REQ_CALL: {
-                bool ok = do_ffi_call(ch);
+                resolve_inline(ch);
+                bool ok = do_ffi_call(ch->func_addr, ch->ret_type, ch->nargs,
+                                      ch->arg_types, ch->args,
+                                      ch->arg_storage, PBOX_ARG_STORAGE,
+                                      ch->result_storage);
                 if (!ok) {
                     fprintf(stderr, "pbox: ffi call failed\n");
                 }
                 break;
             }
+            case PBOX_REQ_DESCRIBE:
+                if (!describe_call(ch->call_desc, ch->ret_type, ch->nargs,
+                                   ch->arg_types))
+                    ch->call_desc = -1;
+                break;
+            case PBOX_REQ_CALL_DESC:
+                if (!do_desc_call(ch->call_desc, ch->func_addr,
+                                  ch->arg_storage, ch->result_storage)) {
+                    fprintf(stderr, "pbox: ffi call failed\n");
+                }
+                break;
+            case PBOX_REQ_RING:
+                drain_ring(ch);
+                break;
             case PBOX_REQ_RECV_FD:
-                ch->received_fd = recv_fd(g_sock_fd);
+                ch->fd_count = recv_fds(g_sock_fd, (int*) ch->arg_storage,
+                                        ch->fd_count);
                 break;
             case PBOX_REQ_SPAWN_WORKER:
                 // Only control channel can spawn workers
@@ -220,6 +506,26 @@ static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
                     pbox_spawn_worker(ch->worker_shm_fd);
                 }
                 break;
+            case PBOX_REQ_SET_AFFINITY:
+                ch->sched_result = pin_self(ch->sched_cpu);
+                break;
+            case PBOX_REQ_SET_SCHED: {
+                struct sched_param param = {
+                    .sched_priority = ch->sched_priority};
+                ch->sched_result =
+                    sched_setscheduler(0, ch->sched_policy, &param) < 0
+                        ? -errno
+                        : 0;
+                break;
+            }
+            case PBOX_REQ_HEAP_INIT:
+                if (is_control && !shared_heap()) {
+                    g_heap.base = (char*) ch->heap_base;
+                    g_heap.size = ch->heap_size;
+                    atomic_store_explicit(&g_heap_ready, 1,
+                                          memory_order_release);
+                }
+                break;
 #ifndef SBOX_NO_CALLBACKS
             case PBOX_REQ_CREATE_CLOSURE: {
                 void* stub = dyfn_closure_alloc(
@@ -227,6 +533,9 @@ static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
                     (enum DyfnType) ch->closure_ret_type,
                     ch->closure_nargs,
                     (const enum DyfnType*) ch->closure_arg_types);
+                int id = ch->closure_callback_id;
+                if (stub && id >= 0 && id < PBOX_MAX_CALLBACKS)
+                    atomic_store(&g_oneway[id], ch->closure_oneway != 0);
                 ch->closure_addr = (uintptr_t) stub;
                 break;
             }
@@ -237,18 +546,14 @@ static void dispatch_loop(struct PBoxChannel* ch, bool is_control) {
         }
 
         // Signal response ready
-        pbox_set_state(&ch->state, PBOX_STATE_RESPONSE);
+        pbox_set_state(ch, PBOX_STATE_RESPONSE);
     }
 }
 
-int main(int argc, char* argv[]) {
-    if (argc != 3) {
-        fprintf(stderr, "Usage: %s <shm_fd> <sock_fd>\n", argv[0]);
-        return 1;
-    }
-
-    int shm_fd = atoi(argv[1]);
-    g_sock_fd = atoi(argv[2]);
+// Run as a sandbox serving the control channel in shm_fd, with sock_fd for
+// receiving fds from the host
+static int sandbox_main(int shm_fd, int sock_fd) {
+    g_sock_fd = sock_fd;
 
     // Map the shared memory (control channel)
     struct PBoxChannel* channel =
@@ -277,3 +582,120 @@ int main(int argc, char* argv[]) {
     munmap(channel, sizeof(struct PBoxChannel));
     return 0;
 }
+
+// Zygote request: the new sandbox's control channel memfd and socket
+static int zygote_recv(int zygote_fd, int fds[2]) {
+    struct msghdr msg = {0};
+    struct iovec iov;
+    char buf[1];
+    char cmsg_buf[CMSG_SPACE(2 * sizeof(int))];
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    ssize_t n = recvmsg(zygote_fd, &msg, 0);
+    if (n <= 0)
+        return n == 0 || errno != EINTR ? -1 : 0;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS ||
+        cmsg->cmsg_len != CMSG_LEN(2 * sizeof(int)))
+        return 0;
+    memcpy(fds, CMSG_DATA(cmsg), 2 * sizeof(int));
+    return 1;
+}
+
+// Zygote reply: the sandbox's pid (or -1) and a pidfd for it
+static void zygote_reply(int zygote_fd, pid_t pid, int pidfd) {
+    struct msghdr msg = {0};
+    struct iovec iov;
+    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+
+    iov.iov_base = &pid;
+    iov.iov_len = sizeof(pid);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (pidfd >= 0) {
+        msg.msg_control = cmsg_buf;
+        msg.msg_controllen = sizeof(cmsg_buf);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &pidfd, sizeof(int));
+    }
+    sendmsg(zygote_fd, &msg, MSG_NOSIGNAL);
+}
+
+static void zygote_reap(int sig) {
+    (void) sig;
+    int saved_errno = errno;
+    while (waitpid(-1, NULL, WNOHANG) > 0)
+        ;
+    errno = saved_errno;
+}
+
+// Zygote mode: the libraries are loaded and initialized once, here, and
+// every sandbox is a copy-on-write fork of this process. The zygote itself
+// runs no sandboxed code and so has no seccomp filter (it needs fork); each
+// child installs the filter before serving its control channel. Children
+// are watched by the host through the pidfd sent back with each reply.
+static int zygote_main(int zygote_fd) {
+    struct sigaction sa = {0};
+    sa.sa_handler = zygote_reap;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigaction(SIGCHLD, &sa, NULL);
+    sigset_t chld;
+    sigemptyset(&chld);
+    sigaddset(&chld, SIGCHLD);
+
+    for (;;) {
+        int fds[2];
+        int got = zygote_recv(zygote_fd, fds);
+        if (got < 0)
+            return 0;  // Host closed the socket
+        if (got == 0)
+            continue;
+
+        // Hold off reaping until the child has a pidfd, so that the pidfd
+        // is sure to refer to it
+        sigprocmask(SIG_BLOCK, &chld, NULL);
+        pid_t pid = fork();
+        if (pid == 0) {
+            signal(SIGCHLD, SIG_DFL);
+            sigprocmask(SIG_UNBLOCK, &chld, NULL);
+            close(zygote_fd);
+            exit(sandbox_main(fds[0], fds[1]));
+        }
+        close(fds[0]);
+        close(fds[1]);
+
+        int pidfd = pid > 0 ? (int) syscall(SYS_pidfd_open, pid, 0) : -1;
+        if (pid > 0 && pidfd < 0) {
+            kill(pid, SIGKILL);
+            pid = -1;
+        }
+        sigprocmask(SIG_UNBLOCK, &chld, NULL);
+        zygote_reply(zygote_fd, pid, pidfd);
+        if (pidfd >= 0)
+            close(pidfd);
+    }
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "--zygote") == 0)
+        return zygote_main(atoi(argv[2]));
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: %s <shm_fd> <sock_fd>\n", argv[0]);
+        fprintf(stderr, "       %s --zygote <sock_fd>\n", argv[0]);
+        return 1;
+    }
+
+    return sandbox_main(atoi(argv[1]), atoi(argv[2]));
+}
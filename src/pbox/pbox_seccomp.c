@@ -7,6 +7,7 @@
 #include <linux/filter.h>
 #include <linux/net.h>
 #include <linux/seccomp.h>
+#include <sched.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <sys/prctl.h>
@@ -135,6 +136,22 @@ int pbox_install_seccomp(void) {
         // === Scheduler (for threads) ===
         BPF_SYSCALL_ALLOW(__NR_sched_yield),
         BPF_SYSCALL_ALLOW(__NR_sched_getaffinity),
+        // Workers may pin themselves (pid 0) to CPUs the host picks...
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_sched_setaffinity, 0, 3),
+        BPF_LOAD_ARG(0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 1),
+        BPF_RETURN(ALLOW),
+        BPF_LOAD_SYSCALL_NR,
+        // ...and choose a policy for themselves, but not a realtime one.
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, __NR_sched_setscheduler, 0, 7),
+        BPF_LOAD_ARG(0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 5),
+        BPF_LOAD_ARG(1),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SCHED_OTHER, 2, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SCHED_BATCH, 1, 0),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, SCHED_IDLE, 0, 1),
+        BPF_RETURN(ALLOW),
+        BPF_LOAD_SYSCALL_NR,
 
         // === Thread creation (for pthread_create) ===
         BPF_SYSCALL_ALLOW(__NR_clone),
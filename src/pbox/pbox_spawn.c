@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+
+#include "pbox_internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#define PBOX_SPAWN_STACK_SIZE (64 * 1024)
+
+struct SpawnArgs {
+    const char* path;
+    char* const* argv;
+    const int* keep_fds;
+    size_t keep_count;
+    const sigset_t* mask;  // The caller's signal mask, restored before exec
+    int err;               // errno of a failed exec
+};
+
+// Runs in the child on its own stack but in the parent's address space, with
+// the parent suspended, so it may only make syscalls: no locks, no malloc,
+// no stdio.
+static int spawn_child(void* arg) {
+    struct SpawnArgs* args = arg;
+
+    // The parent's handlers must not run here, on memory the parent owns
+    for (int sig = 1; sig < _NSIG; sig++) {
+        struct sigaction sa;
+        if (sigaction(sig, NULL, &sa) < 0 || sa.sa_handler == SIG_DFL ||
+            sa.sa_handler == SIG_IGN)
+            continue;
+        sa.sa_handler = SIG_DFL;
+        sa.sa_flags = 0;
+        sigemptyset(&sa.sa_mask);
+        sigaction(sig, &sa, NULL);
+    }
+
+    // Mark all FDs >= 3 as close-on-exec to prevent leaking host FDs,
+    // then clear close-on-exec on the ones we need to pass.
+    close_range(3, ~0U, CLOSE_RANGE_CLOEXEC);
+    for (size_t i = 0; i < args->keep_count; i++)
+        fcntl(args->keep_fds[i], F_SETFD, 0);
+
+    sigprocmask(SIG_SETMASK, args->mask, NULL);
+    execv(args->path, args->argv);
+    args->err = errno;
+    _exit(127);
+}
+
+pid_t pbox_spawn(const char* path, char* const* argv, const int* keep_fds,
+                 size_t keep_count, int* pidfd) {
+    // The child only needs enough stack for a few syscalls
+    void* stack = mmap(NULL, PBOX_SPAWN_STACK_SIZE, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+    if (stack == MAP_FAILED)
+        return -1;
+
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_BLOCK, &all, &old);
+
+    struct SpawnArgs args = {path, argv, keep_fds, keep_count, &old, 0};
+    pid_t pid = clone(spawn_child, (char*) stack + PBOX_SPAWN_STACK_SIZE,
+                      CLONE_VM | CLONE_VFORK | CLONE_PIDFD | SIGCHLD, &args,
+                      pidfd);
+    int err = errno;
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    munmap(stack, PBOX_SPAWN_STACK_SIZE);
+
+    if (pid < 0) {
+        errno = err;
+        return -1;
+    }
+    // CLONE_VFORK returns once the child has exec'd or exited, so a failed
+    // exec is already known
+    if (args.err) {
+        close(*pidfd);
+        waitpid(pid, NULL, 0);
+        errno = args.err;
+        return -1;
+    }
+    return pid;
+}
@@ -0,0 +1,159 @@
+#define _GNU_SOURCE
+
+#include "pbox_window.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// Size class of a block holding length bytes, or -1 if none is big enough
+static int size_class(const struct PBoxWindow* window, size_t length) {
+    size_t pages = (length + window->page - 1) / window->page;
+    int cls = 0;
+    while (((size_t) 1 << cls) < pages) {
+        if (++cls >= PBOX_WINDOW_CLASSES)
+            return -1;
+    }
+    return cls;
+}
+
+static size_t span_of(const struct PBoxWindow* window, size_t length) {
+    return (length + window->page - 1) & ~(window->page - 1);
+}
+
+// Slot in block_class for a block starting at addr (addr must be in the
+// window)
+static size_t page_of(const struct PBoxWindow* window, const void* addr) {
+    return (size_t) ((const char*) addr - window->base) / window->page;
+}
+
+// Check that addr starts a block handed out for length's class (must hold
+// window->lock)
+static int owns_locked(const struct PBoxWindow* window, const void* addr,
+                       int cls) {
+    if (!pbox_window_contains(window, addr) ||
+        ((const char*) addr - window->base) % window->page != 0)
+        return 0;
+    return window->block_class[page_of(window, addr)] == cls + 1;
+}
+
+void pbox_window_init(struct PBoxWindow* window) {
+    window->base = NULL;
+    window->size = 0;
+    window->page = (size_t) sysconf(_SC_PAGESIZE);
+    window->memfd = -1;
+    pthread_mutex_init(&window->lock, NULL);
+    window->tail = 0;
+    window->block_class = NULL;
+    for (int i = 0; i < PBOX_WINDOW_CLASSES; i++) {
+        window->free[i] = NULL;
+        window->free_count[i] = 0;
+        window->free_cap[i] = 0;
+    }
+}
+
+int pbox_window_attach(struct PBoxWindow* window, void* base, size_t size,
+                       int memfd) {
+    // Only touched for pages that start blocks
+    window->block_class = calloc(size / window->page, 1);
+    if (!window->block_class)
+        return -1;
+    window->base = base;
+    window->size = size;
+    window->memfd = memfd;
+    return 0;
+}
+
+void pbox_window_destroy(struct PBoxWindow* window) {
+    if (window->base) {
+        munmap(window->base, window->size);
+        close(window->memfd);
+    }
+    for (int i = 0; i < PBOX_WINDOW_CLASSES; i++)
+        free(window->free[i]);
+    free(window->block_class);
+    pthread_mutex_destroy(&window->lock);
+}
+
+void* pbox_window_alloc(struct PBoxWindow* window, size_t length, int prot) {
+    if (!window->base || length == 0)
+        return NULL;
+    int cls = size_class(window, length);
+    if (cls < 0)
+        return NULL;
+    size_t block = window->page << cls;
+
+    char* addr = NULL;
+    pthread_mutex_lock(&window->lock);
+    if (window->free_count[cls] > 0) {
+        addr = window->free[cls][--window->free_count[cls]];
+    } else if (block <= window->size - window->tail) {
+        addr = window->base + window->tail;
+        window->tail += block;
+    }
+    if (addr)
+        window->block_class[page_of(window, addr)] = (unsigned char) cls + 1;
+    pthread_mutex_unlock(&window->lock);
+    if (!addr)
+        return NULL;
+
+    if (mprotect(addr, span_of(window, length), prot) < 0) {
+        pbox_window_free(window, addr, length);
+        return NULL;
+    }
+    return addr;
+}
+
+int pbox_window_owns(struct PBoxWindow* window, const void* addr,
+                     size_t length) {
+    int cls = size_class(window, length);
+    if (cls < 0 || length == 0)
+        return 0;
+    pthread_mutex_lock(&window->lock);
+    int owns = owns_locked(window, addr, cls);
+    pthread_mutex_unlock(&window->lock);
+    return owns;
+}
+
+int pbox_window_free(struct PBoxWindow* window, void* addr, size_t length) {
+    int cls = size_class(window, length);
+    if (cls < 0 || length == 0)
+        return -1;
+    size_t block = window->page << cls;
+
+    pthread_mutex_lock(&window->lock);
+    if (!owns_locked(window, addr, cls)) {
+        pthread_mutex_unlock(&window->lock);
+        return -1;
+    }
+    window->block_class[page_of(window, addr)] = 0;
+    pthread_mutex_unlock(&window->lock);
+
+    mprotect(addr, span_of(window, length), PROT_NONE);
+    fallocate(window->memfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+              (char*) addr - window->base, block);
+
+    pthread_mutex_lock(&window->lock);
+    if (window->free_count[cls] == window->free_cap[cls]) {
+        size_t cap = window->free_cap[cls] ? window->free_cap[cls] * 2 : 8;
+        char** list = realloc(window->free[cls], cap * sizeof(char*));
+        if (!list) {
+            // The block's address space is lost, but not its memory
+            pthread_mutex_unlock(&window->lock);
+            return 0;
+        }
+        window->free[cls] = list;
+        window->free_cap[cls] = cap;
+    }
+    window->free[cls][window->free_count[cls]++] = addr;
+    pthread_mutex_unlock(&window->lock);
+    return 0;
+}
+
+int pbox_window_contains(const struct PBoxWindow* window, const void* addr) {
+    uintptr_t a = (uintptr_t) addr;
+    uintptr_t base = (uintptr_t) window->base;
+    return window->base && a >= base && a - base < window->size;
+}
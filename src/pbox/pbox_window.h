@@ -0,0 +1,62 @@
+#pragma once
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Identity window: an address range reserved at the same address in the
+// host and the sandbox, backed by one memfd mapped PROT_NONE in both.
+// Identity mappings are carved from it, so making one only takes a change
+// of protection on each side: no fd to send and no address to agree on.
+//
+// Blocks are a power of two pages. Freed blocks go on a list per size and
+// are handed out again before the untouched tail is cut into, so carving
+// and freeing a block take constant time. Each block's size class is
+// recorded, so a block can only be freed whole, with a length of its class.
+// The functions below only touch the host side; the caller changes the
+// sandbox's protection to match.
+
+#define PBOX_WINDOW_DEFAULT_SIZE (1ULL << 28)  // 256MB, populated on demand
+#define PBOX_WINDOW_CLASSES 48
+
+struct PBoxWindow {
+    char* base;  // NULL if there is no window
+    size_t size;
+    size_t page;
+    int memfd;
+    pthread_mutex_t lock;
+    size_t tail;  // Offset of the part never handed out
+    char** free[PBOX_WINDOW_CLASSES];  // Freed blocks by size class
+    size_t free_count[PBOX_WINDOW_CLASSES];
+    size_t free_cap[PBOX_WINDOW_CLASSES];
+    unsigned char* block_class;  // Class + 1 by page at each block's start
+};
+
+// Set up an empty window with nothing reserved
+void pbox_window_init(struct PBoxWindow* window);
+
+// Take over memfd, mapped PROT_NONE at [base, base + size) in both
+// processes, as the window. Returns 0 on success, -1 if out of memory, in
+// which case the caller keeps memfd and the mapping.
+int pbox_window_attach(struct PBoxWindow* window, void* base, size_t size,
+                       int memfd);
+
+// Unmap the window on the host side and free it
+void pbox_window_destroy(struct PBoxWindow* window);
+
+// Carve a block for length bytes and give its first length bytes (rounded
+// up to a page) the protection prot. Returns NULL if there is no window
+// or no room left in it.
+void* pbox_window_alloc(struct PBoxWindow* window, size_t length, int prot);
+
+// Check whether addr is a block from pbox_window_alloc that length fits
+// the size class of, as pbox_window_free requires
+int pbox_window_owns(struct PBoxWindow* window, const void* addr,
+                     size_t length);
+
+// Return a block from pbox_window_alloc, taking the same length. Its
+// memory is released, so it reads as zero when handed out again.
+// Returns 0 on success, -1 if pbox_window_owns fails.
+int pbox_window_free(struct PBoxWindow* window, void* addr, size_t length);
+
+// Check whether addr lies inside the window
+int pbox_window_contains(const struct PBoxWindow* window, const void* addr);
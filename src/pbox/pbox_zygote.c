@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include "pbox.h"
+#include "pbox_internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+struct PBoxZygote {
+    pid_t pid;
+    int pidfd;
+    int sock_fd;           // SOCK_SEQPACKET, one message per request/reply
+    pthread_mutex_t lock;  // One request at a time; guards syms too
+
+    // Symbols resolved in an earlier sandbox. Every child is a fork of the
+    // same process, so the addresses are the same in all of them.
+    void** syms;
+    size_t sym_count;
+};
+
+struct PBoxZygote* pbox_zygote_create(const char* sandbox_executable) {
+    struct PBoxZygote* zygote = calloc(1, sizeof(struct PBoxZygote));
+    if (!zygote)
+        return NULL;
+
+    int sock_fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sock_fds) < 0) {
+        perror("pbox: socketpair");
+        free(zygote);
+        return NULL;
+    }
+
+    // Same fd hygiene as pbox_create: only the socket survives the exec
+    char sock_str[16];
+    snprintf(sock_str, sizeof(sock_str), "%d", sock_fds[1]);
+    char* argv[] = {(char*) sandbox_executable, "--zygote", sock_str, NULL};
+    zygote->pid =
+        pbox_spawn(sandbox_executable, argv, &sock_fds[1], 1, &zygote->pidfd);
+    if (zygote->pid < 0) {
+        fprintf(stderr, "pbox: failed to start %s: %s\n", sandbox_executable,
+                strerror(errno));
+        close(sock_fds[0]);
+        close(sock_fds[1]);
+        free(zygote);
+        return NULL;
+    }
+
+    close(sock_fds[1]);
+    zygote->sock_fd = sock_fds[0];
+    pthread_mutex_init(&zygote->lock, NULL);
+    return zygote;
+}
+
+void pbox_zygote_destroy(struct PBoxZygote* zygote) {
+    // The zygote exits when its socket is closed; the kill covers a zygote
+    // that is stuck
+    close(zygote->sock_fd);
+    syscall(SYS_pidfd_send_signal, zygote->pidfd, SIGKILL, NULL, 0);
+    waitpid(zygote->pid, NULL, 0);
+    close(zygote->pidfd);
+
+    pthread_mutex_destroy(&zygote->lock);
+    free(zygote->syms);
+    free(zygote);
+}
+
+// Send the request: the control channel memfd and the sandbox's socket
+static int zygote_request(int sock_fd, int shm_fd, int box_sock_fd) {
+    struct msghdr msg = {0};
+    struct iovec iov;
+    char buf[1] = {0};
+    char cmsg_buf[CMSG_SPACE(2 * sizeof(int))];
+    int fds[2] = {shm_fd, box_sock_fd};
+
+    iov.iov_base = buf;
+    iov.iov_len = sizeof(buf);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    return sendmsg(sock_fd, &msg, MSG_NOSIGNAL) < 0 ? -1 : 0;
+}
+
+// Receive the reply: the child's pid and a pidfd for it
+static pid_t zygote_reply(int sock_fd, int* pidfd) {
+    struct msghdr msg = {0};
+    struct iovec iov;
+    pid_t pid = -1;
+    char cmsg_buf[CMSG_SPACE(sizeof(int))];
+
+    iov.iov_base = &pid;
+    iov.iov_len = sizeof(pid);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = cmsg_buf;
+    msg.msg_controllen = sizeof(cmsg_buf);
+
+    ssize_t n;
+    do {
+        n = recvmsg(sock_fd, &msg, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+    if (n != sizeof(pid))
+        return -1;
+
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET ||
+        cmsg->cmsg_type != SCM_RIGHTS)
+        return -1;
+    memcpy(pidfd, CMSG_DATA(cmsg), sizeof(int));
+    if (pid <= 0) {
+        close(*pidfd);
+        return -1;
+    }
+    return pid;
+}
+
+pid_t pbox_zygote_spawn(struct PBoxZygote* zygote, int shm_fd, int sock_fd,
+                        int* pidfd) {
+    pthread_mutex_lock(&zygote->lock);
+    pid_t pid = -1;
+    if (zygote_request(zygote->sock_fd, shm_fd, sock_fd) == 0)
+        pid = zygote_reply(zygote->sock_fd, pidfd);
+    pthread_mutex_unlock(&zygote->lock);
+    return pid;
+}
+
+int pbox_zygote_get_syms(struct PBoxZygote* zygote, void** addrs,
+                         size_t count) {
+    pthread_mutex_lock(&zygote->lock);
+    int found = zygote->syms && zygote->sym_count == count;
+    if (found)
+        memcpy(addrs, zygote->syms, count * sizeof(void*));
+    pthread_mutex_unlock(&zygote->lock);
+    return found;
+}
+
+void pbox_zygote_put_syms(struct PBoxZygote* zygote, void* const* addrs,
+                          size_t count) {
+    pthread_mutex_lock(&zygote->lock);
+    if (!zygote->syms) {
+        zygote->syms = malloc(count * sizeof(void*));
+        if (zygote->syms) {
+            memcpy(zygote->syms, addrs, count * sizeof(void*));
+            zygote->sym_count = count;
+        }
+    }
+    pthread_mutex_unlock(&zygote->lock);
+}
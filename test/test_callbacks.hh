@@ -8,6 +8,22 @@ static void my_callback(int x) {
     callback_value = x;
 }
 
+static int record_count = 0;
+static int record_last = -1;
+static bool records_in_order = true;
+
+static void my_record_callback(int i) {
+    if (i != record_last + 1)
+        records_in_order = false;
+    record_last = i;
+    record_count++;
+}
+
+// Adds a and b, but only once record a has been seen
+static int my_after_record_callback(int a, int b) {
+    return record_last == a ? a + b : -1;
+}
+
 static int my_add_callback(int a, int b) {
     return a + b;
 }
@@ -128,4 +128,24 @@
         sandbox.idmem_reset();
     }
     PASS();
+
+    TEST("one-way callback (void(int))");
+    record_count = 0;
+    record_last = -1;
+    records_in_order = true;
+    auto rec_cb = sandbox.register_oneway_callback(my_record_callback);
+    assert(rec_cb != nullptr);
+    sandbox.call<void(void (*)(int), int)>("emit_records", rec_cb, 1000);
+    assert(record_count == 1000);
+    assert(records_in_order);
+    PASS();
+
+    TEST("one-way callbacks run before later synchronous ones");
+    record_last = 6;
+    auto after_cb = sandbox.register_callback(my_after_record_callback);
+    assert(after_cb != nullptr);
+    cbr = sandbox.call<int(void (*)(int), int (*)(int, int), int, int)>(
+        "emit_then_apply", rec_cb, after_cb, 7, 8);
+    assert(cbr == 15);
+    PASS();
 }
@@ -14,9 +14,62 @@
     }
     PASS();
 
+    TEST("SBOX_FN: call site resolves once");
+    for (int i = 0; i < 100; i++) {
+        assert(sandbox.call(SBOX_FN(add), i, 1) == i + 1);
+    }
+    PASS();
+
+    TEST("SBOX_FN: fn handle");
+    auto typed_add_fn = sandbox.fn(SBOX_FN(add));
+    assert(typed_add_fn(20, 22) == 42);
+    PASS();
+
     TEST("fn handle: add_double(1.1, 2.2)");
     auto add_double_fn = sandbox.fn<double(double, double)>("add_double");
     double dr = add_double_fn(1.1, 2.2);
     assert(fabs(dr - 3.3) < 1e-9);
     PASS();
+
+    TEST("fn handle: arguments passed on the stack");
+    auto sum10_fn =
+        sandbox.fn<int(int, int, int, int, int, int, int, int, int, int)>(
+            "sum10");
+    auto mixed10_fn = sandbox.fn<double(int, double, int, double, int, double,
+                                        int, double, int, double)>("mixed10");
+    for (int i = 0; i < 10; i++) {
+        assert(sum10_fn(1, 2, 3, 4, 5, 6, 7, 8, 9, i) == 45 + i);
+        double mr = mixed10_fn(1, 2.0, 3, 4.0, 5, 6.0, 7, 8.0, 9, i + 0.5);
+        assert(fabs(mr - (45.5 + i)) < 1e-9);
+    }
+    PASS();
+
+    TEST("fn handle: batch of mixed calls");
+    auto multiply_fn = sandbox.fn<int(int, int)>("multiply");
+    auto noop_fn = sandbox.fn<void()>("noop");
+    auto batch = sandbox.batch();
+    int bsum = 0, bproduct = 0;
+    double bdsum = 0;
+    batch.add(&bsum, add_fn, 2, 3);
+    batch.add(noop_fn);
+    batch.add(&bproduct, multiply_fn, 4, 5);
+    batch.add(&bdsum, add_double_fn, 1.5, 2.25);
+    assert(batch.size() == 4);
+    batch.run();
+    assert(batch.size() == 0);
+    assert(bsum == 5);
+    assert(bproduct == 20);
+    assert(fabs(bdsum - 3.75) < 1e-9);
+    PASS();
+
+    TEST("fn handle: batch reused for many calls");
+    int bresults[100];
+    for (int i = 0; i < 100; i++) {
+        batch.add(&bresults[i], add_fn, i, 1);
+    }
+    batch.run();
+    for (int i = 0; i < 100; i++) {
+        assert(bresults[i] == i + 1);
+    }
+    PASS();
 }
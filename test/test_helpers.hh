@@ -24,6 +24,13 @@ struct NamedArray {
     int count;
 };
 
+// -- Function declarations (must match testlib.c), for SBOX_FN --
+
+extern "C" {
+int add(int a, int b);
+void fill_ints(int* arr, int count, int value);
+}
+
 // -- Test runner macros (TAP output) --
 
 static int tests_run = 0;
@@ -35,4 +35,22 @@
     sb2.free(buf2);
     PASS();
 
+    TEST("SBOX_FN call site shared by two sandboxes");
+    auto fill = [](auto& sb, auto buf, int value) {
+        sb.call(SBOX_FN(fill_ints), buf, 4, value);
+    };
+    auto sbuf1 = sb1.template alloc<int>(4);
+    auto sbuf2 = sb2.template alloc<int>(4);
+    for (int round = 0; round < 3; round++) {
+        fill(sb1, sbuf1, round);
+        fill(sb2, sbuf2, 100 + round);
+        sb1.copy_from(host1, sbuf1, sizeof(int) * 4);
+        sb2.copy_from(host2, sbuf2, sizeof(int) * 4);
+        assert(host1[3] == round + 3);
+        assert(host2[3] == 100 + round + 3);
+    }
+    sb1.free(sbuf1);
+    sb2.free(sbuf2);
+    PASS();
+
 }
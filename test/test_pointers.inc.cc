@@ -29,4 +29,34 @@
     sandbox.free(a);
     sandbox.free(b);
     PASS();
+
+    TEST("context: arrays and strings");
+    {
+        int vals[100];
+        for (int i = 0; i < 100; i++)
+            vals[i] = i;
+        static int filled[2000];  // Larger than a stack-staged array
+        char word[] = "sandbox";
+        {
+            auto ctx = sandbox.context();
+            const int* vin = ctx.in(vals, 100);
+            assert(sandbox.call<int(const int*, int)>(ctx, "sum_ints", vin,
+                                                      100) == 4950);
+        }
+        {
+            auto ctx = sandbox.context();
+            sandbox.call<void(int*, int, int)>(ctx, "fill_ints",
+                                               ctx.out(filled, 2000), 2000, 7);
+        }
+        assert(filled[0] == 7 && filled[1999] == 2006);
+        {
+            auto ctx = sandbox.context();
+            sandbox.call<void(char*)>(ctx, "string_to_upper",
+                                      ctx.inout(word, sizeof(word)));
+            assert(sandbox.call<int(const char*)>(
+                       ctx, "string_length", ctx.in_string("hello")) == 5);
+        }
+        assert(std::strcmp(word, "SANDBOX") == 0);
+    }
+    PASS();
 }
@@ -1,6 +1,168 @@
 #include "sbox/process.hh"
 #include "test_helpers.hh"
 
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <memory>
+#include <string>
+#include <sys/mman.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+// Number of threads in a process
+static int count_tasks(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+    int n = 0;
+    while (struct dirent* e = readdir(dir)) {
+        if (e->d_name[0] != '.')
+            n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// Number of open fds in a process
+static int count_fds(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/fd", (int) pid);
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+    int n = 0;
+    while (struct dirent* e = readdir(dir)) {
+        if (e->d_name[0] != '.')
+            n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// What fd refers to in a process, such as "pipe:[1234]"
+static std::string fd_target(pid_t pid, int fd) {
+    char path[64], target[256];
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int) pid, fd);
+    ssize_t n = readlink(path, target, sizeof(target) - 1);
+    return n < 0 ? std::string() : std::string(target, n);
+}
+
+// Permissions of the mapping holding addr in a process, such as "rw-p"
+static std::string mapping_perms(pid_t pid, const void* addr) {
+    char path[64], line[512];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+    FILE* f = fopen(path, "r");
+    if (!f)
+        return std::string();
+    std::string perms;
+    uintptr_t a = reinterpret_cast<uintptr_t>(addr);
+    while (fgets(line, sizeof(line), f)) {
+        unsigned long start, end;
+        char p[5];
+        if (sscanf(line, "%lx-%lx %4s", &start, &end, p) == 3 && a >= start &&
+            a < end) {
+            perms = p;
+            break;
+        }
+    }
+    fclose(f);
+    return perms;
+}
+
+// Number of threads in a process running under a scheduling policy
+static int count_tasks_with_policy(pid_t pid, int policy) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+    int n = 0;
+    while (struct dirent* e = readdir(dir)) {
+        if (e->d_name[0] == '.')
+            continue;
+        char stat_path[512], buf[1024];
+        snprintf(stat_path, sizeof(stat_path), "%s/%s/stat", path, e->d_name);
+        FILE* f = fopen(stat_path, "r");
+        if (!f)
+            continue;
+        size_t len = fread(buf, 1, sizeof(buf) - 1, f);
+        fclose(f);
+        buf[len] = '\0';
+
+        // policy is field 41; fields after the name start at 3
+        const char* p = strrchr(buf, ')');
+        int field = 2;
+        while (p && field < 41) {
+            p = strchr(p + 1, ' ');
+            field++;
+        }
+        if (p && atoi(p + 1) == policy)
+            n++;
+    }
+    closedir(dir);
+    return n;
+}
+
+// Number of threads in a process whose /proc status line for key (such as
+// "State") has exactly the given value
+static int count_tasks_with_status(pid_t pid, const char* key,
+                                   const char* value) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", (int) pid);
+    DIR* dir = opendir(path);
+    if (!dir)
+        return -1;
+    size_t key_len = strlen(key);
+    int n = 0;
+    while (struct dirent* e = readdir(dir)) {
+        if (e->d_name[0] == '.')
+            continue;
+        char status_path[512], line[256];
+        snprintf(status_path, sizeof(status_path), "%s/%s/status", path,
+                 e->d_name);
+        FILE* f = fopen(status_path, "r");
+        if (!f)
+            continue;
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, key, key_len) != 0 || line[key_len] != ':')
+                continue;
+            const char* v = line + key_len + 1;
+            v += strspn(v, " \t");
+            if (strcspn(v, "\n") == strlen(value) &&
+                strncmp(v, value, strlen(value)) == 0)
+                n++;
+            break;
+        }
+        fclose(f);
+    }
+    closedir(dir);
+    return n;
+}
+
+static int async_add_callback(int a, int b) {
+    return a + b;
+}
+
+// Kills the sandbox calling it, so the call it is nested in never returns
+static pid_t victim_pid;
+static int kill_caller_callback(int a, int b) {
+    kill(victim_pid, SIGKILL);
+    usleep(50000);
+    return a + b;
+}
+
 int main() {
     sbox::Sandbox<sbox::Process> sandbox("./test_sandbox");
 
@@ -13,5 +175,797 @@ int main() {
     assert(sandbox.alive());
     PASS();
 
+    TEST("wait policy round-trips");
+    PBoxWaitPolicy policy = {5000, 0};
+    sandbox.set_wait_policy(policy);
+    assert(sandbox.wait_policy().spin_max_ns == 5000);
+    assert(sandbox.wait_policy().adaptive == 0);
+    PASS();
+
+    TEST("calls with fixed and adaptive spinning");
+    for (int adaptive = 0; adaptive <= 1; adaptive++) {
+        sandbox.set_wait_policy({20000, adaptive});
+        for (int i = 0; i < 1000; i++) {
+            assert(sandbox.call<int(int, int)>("add", i, i + 1) == 2 * i + 1);
+        }
+    }
+    PASS();
+
+    TEST("calls with spinning disabled");
+    sandbox.set_wait_policy({0, 0});
+    for (int i = 0; i < 100; i++) {
+        assert(sandbox.call<int(int, int)>("add", i, 1) == i + 1);
+    }
+    PASS();
+
+    TEST("call_async + get");
+    auto pending = sandbox.call_async<int(int, int)>("add", 20, 22);
+    assert(pending.get() == 42);
+    PASS();
+
+    TEST("call_async polls until ready");
+    auto polled = sandbox.call_async<int(int, int)>("multiply", 6, 7);
+    while (!polled.ready()) {
+    }
+    assert(polled.get() == 42);
+    PASS();
+
+    TEST("call_async then sync call on same thread");
+    auto first = sandbox.call_async<int(int, int)>("add", 1, 2);
+    assert(sandbox.call<int(int, int)>("add", 3, 4) == 7);
+    assert(first.get() == 3);
+    PASS();
+
+    TEST("fn handles describe each signature once");
+    {
+        auto multiply_fn = sandbox.fn<int(int, int)>("multiply");
+        PBoxType types[] = {PBOX_TYPE_SINT32, PBOX_TYPE_SINT32};
+        int desc = pbox_describe_call(sandbox.native_handle(),
+                                      PBOX_TYPE_SINT32, 2, types);
+        assert(desc >= 0);
+        assert(pbox_describe_call(sandbox.native_handle(), PBOX_TYPE_SINT32,
+                                  2, types) == desc);
+        assert(multiply_fn(6, 7) == 42);
+
+        int args[] = {40, 2};
+        uint64_t packed[2];
+        std::memcpy(&packed[0], &args[0], sizeof(int));
+        std::memcpy(&packed[1], &args[1], sizeof(int));
+        int result = 0;
+        pbox_call_desc(sandbox.native_handle(), desc,
+                       pbox_dlsym(sandbox.native_handle(), "add"), packed,
+                       &result);
+        assert(result == 42);
+    }
+    PASS();
+
+    TEST("fn handle async");
+    auto add_fn = sandbox.fn<int(int, int)>("add");
+    auto a1 = add_fn.async(100, 200);
+    assert(a1.get() == 300);
+    PASS();
+
+    TEST("void call_async");
+    sandbox.call_async<void()>("noop").get();
+    assert(sandbox.call<int()>("was_noop_called") == 1);
+    PASS();
+
+    TEST("call_async with callback");
+    auto cb = sandbox.register_callback(async_add_callback);
+    auto with_cb = sandbox.call_async<int(int (*)(int, int), int, int)>(
+        "apply_binary_callback", cb, 5, 6);
+    assert(with_cb.get() == 11);
+    PASS();
+
+    TEST("pipelined call_async");
+    std::deque<sbox::AsyncCall<int>> window;
+    int expected = 0, total = 0;
+    for (int i = 0; i < 200; i++) {
+        window.push_back(sandbox.call_async<int(int, int)>("add", i, 1));
+        expected += i + 1;
+        if (window.size() == 32) {
+            total += window.front().get();
+            window.pop_front();
+        }
+    }
+    while (!window.empty()) {
+        total += window.front().get();
+        window.pop_front();
+    }
+    assert(total == expected);
+    PASS();
+
+    TEST("copy_to/copy_from large buffer");
+    const size_t big = 1 << 20;
+    std::vector<unsigned char> src(big), dst(big);
+    for (size_t i = 0; i < big; i++)
+        src[i] = static_cast<unsigned char>(i * 7);
+    auto sbuf = sandbox.alloc<unsigned char>(big);
+    assert(sbuf);
+    sandbox.copy_to(sbuf, src.data(), big);
+    sandbox.copy_from(dst.data(), sbuf, big);
+    assert(dst == src);
+    sandbox.free(sbuf);
+    PASS();
+
+    TEST("copy_to_v/copy_from_v");
+    auto va = sandbox.alloc<int>(4);
+    auto vb = sandbox.alloc<int>(2);
+    int in_a[4] = {1, 2, 3, 4}, in_b[2] = {5, 6};
+    PBoxCopyRegion to[] = {{va.unsafe_unverified(), in_a, sizeof(in_a)},
+                           {vb.unsafe_unverified(), in_b, sizeof(in_b)},
+                           {va.unsafe_unverified(), in_a, 0}};
+    sandbox.copy_to_v(to, 3);
+    assert(sandbox.call<int(int*)>("read_int", vb) == 5);
+    int out_a[4] = {}, out_b[2] = {};
+    PBoxCopyRegion from[] = {{vb.unsafe_unverified(), out_b, sizeof(out_b)},
+                             {va.unsafe_unverified(), out_a, sizeof(out_a)}};
+    sandbox.copy_from_v(from, 2);
+    assert(memcmp(out_a, in_a, sizeof(in_a)) == 0);
+    assert(memcmp(out_b, in_b, sizeof(in_b)) == 0);
+    sandbox.free(va);
+    sandbox.free(vb);
+    PASS();
+
+    TEST("alloc is directly accessible after verify");
+    auto hp = sandbox.alloc<int>(4);
+    auto hsafe = sandbox.verify(hp, 4);
+    hsafe[0] = 10;
+    hsafe[3] = 40;
+    assert(sandbox.call<int(int*)>("read_int", hp) == 10);
+    sandbox.call<void(int*, int)>("write_int", hp, 7);
+    assert(hsafe[0] == 7);
+    auto hgrown = sandbox.realloc(hp, 1024);
+    auto gsafe = sandbox.verify(hgrown, 1024);
+    assert(gsafe[0] == 7 && gsafe[3] == 40);
+    sandbox.free(hgrown);
+    PASS();
+
+    TEST("sandbox malloc is host-verifiable and host-freeable");
+    auto smem = sandbox.call<char*(size_t)>("malloc", 64);
+    auto ssafe = sandbox.verify(smem, 64);
+    std::strcpy(ssafe.data(), "shared");
+    assert(sandbox.call<int(const char*)>("string_length", smem) == 6);
+    sandbox.free(smem);
+    PASS();
+
+    TEST("call context grows past the default idmem region");
+    {
+        constexpr int n = 512 * 1024;  // 2MB of ints
+        using Big = std::array<int, n>;
+        auto big = std::make_unique<Big>();
+        for (int i = 0; i < n; i++)
+            (*big)[i] = i % 7;
+        auto out = std::make_unique<Big>();
+        int expect = 0;
+        for (int v : *big)
+            expect += v;
+        {
+            auto ctx = sandbox.context();
+            const Big* vin = ctx.in(*big);
+            assert(sandbox.call<int(const int*, int)>(ctx, "sum_ints",
+                                                      vin->data(), n) ==
+                   expect);
+        }
+        {
+            // Scratch from the first context is reused after its reset
+            auto ctx = sandbox.context();
+            Big* vout = ctx.out(*out);
+            sandbox.call<void(int*, int, int)>(ctx, "fill_ints", vout->data(),
+                                               n, 3);
+        }
+        assert((*out)[0] == 3 && (*out)[n - 1] == n + 2);
+        auto stats = sandbox.idmem_stats();
+        assert(stats.in_use == 0);
+        assert(stats.high_water >= sizeof(Big));
+        assert(stats.mapped >= sizeof(Big));
+    }
+    PASS();
+
+    TEST("one large scratch allocation does not inflate later chunks");
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        const size_t large = 96 << 20;  // Past the growth cap
+        assert(box.idmem_alloc<char>(large));
+        auto before = box.idmem_stats();
+        assert(box.idmem_alloc<char>(4096));
+        assert(box.idmem_alloc<char>(large / 2));
+        auto after = box.idmem_stats();
+        assert(after.chunks == before.chunks + 2);
+        assert(after.mapped - before.mapped < large);
+        box.idmem_reset();
+    }
+    PASS();
+
+    TEST("call context copies back more out-params than it keeps inline");
+    {
+        int outs[20] = {};
+        int inouts[4] = {1, 2, 3, 4};
+        {
+            auto ctx = sandbox.context();
+            for (int i = 0; i < 20; i++)
+                sandbox.call<void(int*, int)>("write_int", ctx.out(outs[i]),
+                                              i * 3);
+            for (int i = 0; i < 4; i++) {
+                int* p = ctx.inout(inouts[i]);
+                int v = sandbox.call<int(int*)>("read_int", p);
+                sandbox.call<void(int*, int)>("write_int", p, v * 10);
+            }
+            assert(outs[19] == 0);  // Nothing is copied before finalize
+        }
+        for (int i = 0; i < 20; i++)
+            assert(outs[i] == i * 3);
+        for (int i = 0; i < 4; i++)
+            assert(inouts[i] == (i + 1) * 10);
+    }
+    PASS();
+
+    TEST("small by-pointer arguments travel in the call message");
+    {
+        struct Pt {
+            int x;
+            int y;
+        };
+        Pt pt{};
+        sandbox.call<void(Pt*, int, int)>("point_init", sbox::inline_out(pt),
+                                          3, 4);
+        assert(pt.x == 3 && pt.y == 4);
+        sandbox.call<void(Pt*, int)>("point_scale", sbox::inline_inout(pt),
+                                     10);
+        assert(pt.x == 30 && pt.y == 40);
+        assert(sandbox.call<int(Pt*)>("point_sum", sbox::inline_in(pt)) ==
+               70);
+
+        char word[16] = "inline";
+        sandbox.call<void(char*)>("string_to_upper", sbox::inline_inout(word));
+        assert(std::strcmp(word, "INLINE") == 0);
+        int a = 5, b = 6;
+        sandbox.call<void(int*, int*)>("swap_ints", sbox::inline_inout(a),
+                                       sbox::inline_inout(b));
+        assert(a == 6 && b == 5);
+
+        // Too much for the message: the C API refuses
+        static char big[PBOX_INLINE_MAX + 1];
+        PBoxType types[] = {PBOX_TYPE_POINTER};
+        void* dummy = nullptr;
+        void* args[] = {&dummy};
+        PBoxInlineArg inl = {0, big, sizeof(big), PBOX_INLINE_IN};
+        int len = 0;
+        assert(pbox_call_inline(sandbox.native_handle(),
+                                pbox_dlsym(sandbox.native_handle(),
+                                           "string_length"),
+                                PBOX_TYPE_SINT32, 1, types, args, &inl, 1,
+                                &len) == -1);
+    }
+    PASS();
+
+    TEST("idmem_malloc survives reset and frees individually");
+    {
+        auto before = sandbox.idmem_stats();
+        int* keep = sandbox.idmem_malloc<int>(100);
+        assert(keep);
+        sandbox.call<void(int*, int, int)>("fill_ints", keep, 100, 9);
+        sandbox.idmem_reset();
+        assert(sandbox.call<int(int*, int)>("sum_ints", keep, 100) ==
+               900 + 4950);
+
+        // Freed blocks are reused for the same size class
+        sandbox.idmem_free(keep);
+        int* again = sandbox.idmem_malloc<int>(100);
+        assert(again == keep);
+        sandbox.idmem_free(again);
+        sandbox.idmem_free(again);  // Double free is ignored
+        assert(sandbox.idmem_stats().in_use == before.in_use);
+
+        // Large blocks get their own region, returned on free
+        char* large = sandbox.idmem_malloc<char>(4 << 20);
+        assert(large);
+        large[(4 << 20) - 1] = 'x';
+        assert(sandbox.idmem_stats().mapped >= before.mapped + (4 << 20));
+        sandbox.idmem_free(large);
+        auto after = sandbox.idmem_stats();
+        assert(after.in_use == before.in_use);
+        assert(after.high_water >= before.in_use + (4 << 20));
+    }
+    PASS();
+
+    TEST("mmap_identity regions verify from many threads");
+    {
+        const size_t len = 64 * 1024;
+        char* region = static_cast<char*>(
+            sandbox.mmap_identity(len, PROT_READ | PROT_WRITE));
+        assert(region);
+        auto safe = sandbox.verify(sbox::sbox<char*>(region), len);
+        safe[len - 1] = 'z';
+
+        // Verify the long-lived region while another thread keeps mapping
+        // and unmapping regions next to it
+        std::atomic<bool> stop{false};
+        std::thread churn([&] {
+            while (!stop) {
+                void* p = sandbox.mmap_identity(4096, PROT_READ | PROT_WRITE);
+                assert(p);
+                sandbox.munmap_identity(p, 4096);
+            }
+        });
+        std::vector<std::thread> readers;
+        for (int t = 0; t < 4; t++) {
+            readers.emplace_back([&] {
+                for (int i = 0; i < 20000; i++)
+                    sandbox.verify(sbox::sbox<char*>(region + i % len), 1);
+            });
+        }
+        for (auto& r : readers)
+            r.join();
+        stop = true;
+        churn.join();
+        assert(sandbox.munmap_identity(region, len) == 0);
+    }
+    PASS();
+
+    TEST("SBOX_FN is a constant shared by every use of a function");
+    {
+        // Usable where only constant or unevaluated expressions are
+        constexpr auto add_name = SBOX_FN(add);
+        static_assert(std::is_same_v<decltype(SBOX_FN(add)),
+                                     sbox::TypedName<int (*)(int, int)>>);
+        static_assert(SBOX_FN(add).site == add_name.site);
+
+        // Resolved once, from whichever use comes first
+        sbox::detail::SiteSymbolCache cache;
+        int lookups = 0;
+        auto resolve = [&](const char* name) {
+            lookups++;
+            return static_cast<void*>(const_cast<char*>(name));
+        };
+        for (int i = 0; i < 10; i++) {
+            auto tn = i % 2 ? SBOX_FN(add) : add_name;
+            assert(cache.lookup(tn.site, tn.name, resolve) == tn.name);
+        }
+        auto other = SBOX_FN(fill_ints);
+        cache.lookup(other.site, other.name, resolve);
+        assert(lookups == 2);
+    }
+    PASS();
+
+    TEST("sandbox created with preloaded symbols");
+    {
+        sbox::Sandbox<sbox::Process> warm(
+            "./test_sandbox", {"add", SBOX_FN(fill_ints), "no_such_symbol"});
+        assert(warm.call(SBOX_FN(add), 40, 2) == 42);
+        assert(warm.call<int(int, int)>("add", 1, 2) == 3);
+
+        // More names than fit in one exchange
+        std::vector<const char*> names;
+        for (int i = 0; i < 300; i++)
+            names.push_back(i % 3 == 2 ? "no_such_symbol" : "sum_ints");
+        assert(warm.preload(names.data(), names.size()) == 200);
+    }
+    PASS();
+
+    TEST("prespawned channels serve new threads");
+    {
+        PBoxOptions options = {};
+        options.prespawn_channels = 4;
+        sbox::Sandbox<sbox::Process> pooled("./test_sandbox", options);
+
+        // More threads than the pool holds, in waves, so some claim
+        // channels that were refilled in the background
+        for (int wave = 0; wave < 3; wave++) {
+            std::vector<std::thread> threads;
+            std::atomic<int> ok{0};
+            for (int t = 0; t < 6; t++) {
+                threads.emplace_back([&, t] {
+                    if (pooled.call<int(int, int)>("add", t, wave) == t + wave)
+                        ok++;
+                });
+            }
+            for (auto& th : threads)
+                th.join();
+            assert(ok == 6);
+        }
+    }
+    PASS();
+
+    TEST("channel pools share one refill thread");
+    {
+        int host_tasks = count_tasks(getpid());
+        PBoxOptions options = {};
+        options.prespawn_channels = 2;
+        std::vector<std::unique_ptr<sbox::Sandbox<sbox::Process>>> boxes;
+        for (int i = 0; i < 4; i++) {
+            boxes.push_back(std::make_unique<sbox::Sandbox<sbox::Process>>(
+                "./test_sandbox", options));
+        }
+        // Each claim sets off a refill
+        for (auto& box : boxes) {
+            std::thread t([&] {
+                assert(box->call<int(int, int)>("add", 1, 2) == 3);
+            });
+            t.join();
+        }
+        assert(count_tasks(getpid()) <= host_tasks + 1);
+    }
+    PASS();
+
+    TEST("shared channels serve more threads than workers");
+    {
+        PBoxOptions options = {};
+        options.max_channels = 2;
+        options.prespawn_channels = 1;
+        sbox::Sandbox<sbox::Process> shared("./test_sandbox", options);
+        int base_tasks = count_tasks(shared.pid());
+        assert(base_tasks >= 1);
+
+        for (int wave = 0; wave < 3; wave++) {
+            std::vector<std::thread> threads;
+            std::atomic<int> ok{0};
+            for (int t = 0; t < 8; t++) {
+                threads.emplace_back([&, t] {
+                    bool good =
+                        shared.call<int(int, int)>("add", t, wave) == t + wave;
+
+                    // The channel is held until the result is claimed
+                    auto pending =
+                        shared.call_async<int(int, int)>("add", t, 1);
+                    good = good && shared.call<int(int, int)>(
+                                       "multiply", t, 2) == t * 2;
+                    good = good && pending.get() == t + 1;
+
+                    // And while the context's scratch memory is live
+                    std::array<int, 64> vals;
+                    vals.fill(t);
+                    {
+                        auto ctx = shared.context();
+                        const auto* vin = ctx.in(vals);
+                        good = good && shared.call<int(const int*, int)>(
+                                           ctx, "sum_ints", vin->data(),
+                                           64) == 64 * t;
+                    }
+                    if (good)
+                        ok++;
+                });
+            }
+            for (auto& th : threads)
+                th.join();
+            assert(ok == 8);
+        }
+
+        // Only the prespawned channel and one more were ever started
+        assert(count_tasks(shared.pid()) <= base_tasks + 1);
+        assert(shared.call<int(int, int)>("add", 1, 1) == 2);
+    }
+    PASS();
+
+    TEST("sandbox pool hands out fresh preloaded sandboxes");
+    {
+        sbox::SandboxPool<sbox::Process> pool("./test_sandbox", 2,
+                                              {"add", "multiply"});
+        for (int i = 0; i < 500 && pool.ready() < 2; i++)
+            usleep(10000);
+        assert(pool.ready() == 2);
+
+        // More sandboxes than the pool holds: the rest are created on
+        // demand or come from the background refill
+        std::vector<pid_t> pids;
+        for (int i = 0; i < 4; i++) {
+            auto sandbox = pool.acquire();
+            assert(sandbox && sandbox->alive());
+            // Warming it started no worker: only the main thread runs
+            assert(count_tasks(sandbox->pid()) == 1);
+            assert(sandbox->call<int(int, int)>("add", i, 1) == i + 1);
+            assert(sandbox->call<int(int, int)>("multiply", i, 3) == i * 3);
+            for (pid_t pid : pids)
+                assert(sandbox->pid() != pid);
+            pids.push_back(sandbox->pid());
+        }
+
+        // Retired sandboxes are destroyed and replaced in the background
+        for (int i = 0; i < 500 && pool.ready() < 2; i++)
+            usleep(10000);
+        assert(pool.ready() == 2);
+        for (int i = 0; i < 500 && kill(pids[0], 0) == 0; i++)
+            usleep(10000);
+        assert(kill(pids[0], 0) != 0);
+    }
+    PASS();
+
+    TEST("sandboxes forked from a zygote");
+    {
+        PBoxZygote* zygote = pbox_zygote_create("./test_sandbox");
+        assert(zygote);
+        PBoxOptions options = {};
+        options.zygote = zygote;
+        {
+            sbox::Sandbox<sbox::Process> a("ignored", options);
+            sbox::Sandbox<sbox::Process> b("ignored", options);
+            assert(a.alive() && b.alive() && a.pid() != b.pid());
+            assert(a.call<int(int, int)>("add", 2, 3) == 5);
+            assert(b.call<int(int, int)>("multiply", 4, 5) == 20);
+
+            // Memory and callbacks work as in an exec'd sandbox
+            auto buf = b.alloc<int>(16);
+            b.call<void(int*, int, int)>("fill_ints", buf, 16, 1);
+            int host[16];
+            b.copy_from(host, buf, sizeof(host));
+            assert(host[0] == 1 && host[15] == 16);
+            b.free(buf);
+            auto cb = a.register_callback(async_add_callback);
+            assert(a.call<int(int (*)(int, int), int, int)>(
+                       "apply_binary_callback", cb, 20, 22) == 42);
+
+            // Death is noticed even though the sandbox is not our child
+            kill(b.pid(), SIGKILL);
+            for (int i = 0; i < 500 && b.alive(); i++)
+                usleep(10000);
+            assert(!b.alive());
+            assert(a.call<int(int, int)>("add", 1, 1) == 2);
+        }
+
+        // Sandboxes outlive the zygote
+        sbox::Sandbox<sbox::Process> c("ignored", options);
+        pbox_zygote_destroy(zygote);
+        assert(c.call<int(int, int)>("add", 40, 2) == 42);
+
+        // Pools can draw from a zygote too
+        zygote = pbox_zygote_create("./test_sandbox");
+        assert(zygote);
+        options.zygote = zygote;
+        {
+            sbox::SandboxPool<sbox::Process> pool("ignored", 1, options,
+                                                  {"add"});
+            for (int i = 0; i < 3; i++) {
+                auto sandbox = pool.acquire();
+                assert(sandbox);
+                assert(sandbox->call<int(int, int)>("add", i, i) == 2 * i);
+            }
+        }
+        pbox_zygote_destroy(zygote);
+    }
+    PASS();
+
+    TEST("sandboxes are spawned with only their own fds");
+    {
+        // Not close-on-exec, and at a number the sandbox won't reuse
+        int fds[2];
+        assert(pipe(fds) == 0);
+        int leaked = fcntl(fds[0], F_DUPFD, 900);
+        assert(leaked >= 900);
+
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        assert(box.call<int(int, int)>("add", 2, 3) == 5);
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/fd/%d", (int) box.pid(),
+                 leaked);
+        assert(access(path, F_OK) < 0);
+
+        close(leaked);
+        close(fds[0]);
+        close(fds[1]);
+
+        assert(!pbox_create("./no_such_sandbox"));
+    }
+    PASS();
+
+    TEST("identity mappings are carved from a reserved window");
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        void* first = box.mmap_identity(4096, PROT_READ | PROT_WRITE);
+        assert(first);
+        int fds_before = count_fds(box.pid());
+
+        for (int i = 0; i < 500; i++) {
+            size_t len = 4096 << (i % 4);
+            int* p = static_cast<int*>(
+                box.mmap_identity(len, PROT_READ | PROT_WRITE));
+            assert(p);
+            // Blocks are reused, and read as zero each time
+            assert(p[0] == 0 && p[len / sizeof(int) - 1] == 0);
+            p[0] = i;
+            sbox::sbox<int*> shared(p);
+            assert(box.call<int(int*)>("read_int", shared) == i);
+            box.call<void(int*, int)>("write_int", shared, i + 1);
+            assert(p[0] == i + 1);
+            p[len / sizeof(int) - 1] = i;
+            assert(box.munmap_identity(p, len) == 0);
+        }
+
+        // No fd is sent to the sandbox per mapping
+        assert(count_fds(box.pid()) == fds_before);
+
+        // Blocks are only given back whole, and only once
+        void* block = box.mmap_identity(4096, PROT_READ | PROT_WRITE);
+        assert(block);
+        assert(box.munmap_identity(block, 8192) == -1 && errno == EINVAL);
+        assert(box.munmap_identity(static_cast<char*>(block) + 16, 16) == -1);
+        assert(box.munmap_identity(block, 4096) == 0);
+        assert(box.munmap_identity(block, 4096) == -1);
+        assert(box.munmap_identity(first, 4096) == 0);
+    }
+
+    // An exiting thread's arena is closed off in the sandbox too, before
+    // the window hands it out again
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        int* p = nullptr;
+        std::thread t([&] {
+            p = box.idmem_alloc<int>();
+            assert(p);
+            box.call<void(int*, int)>("write_int", sbox::sbox<int*>(p), 7);
+            assert(*p == 7);
+            assert(mapping_perms(box.pid(), p) == "rw-s");
+        });
+        t.join();
+        assert(mapping_perms(box.pid(), p) == "---s");
+    }
+
+    // Mappings that don't fit the window, or with no window at all, are
+    // made on their own
+    for (size_t window : {size_t(64 * 1024), PBOX_IDENTITY_WINDOW_NONE}) {
+        PBoxOptions options = {};
+        options.identity_window = window;
+        sbox::Sandbox<sbox::Process> box("./test_sandbox", options);
+        int* small = static_cast<int*>(
+            box.mmap_identity(4096, PROT_READ | PROT_WRITE));
+        int* large = static_cast<int*>(
+            box.mmap_identity(1 << 20, PROT_READ | PROT_WRITE));
+        assert(small && large);
+        box.call<void(int*, int)>("write_int", sbox::sbox<int*>(small), 1);
+        box.call<void(int*, int)>("write_int", sbox::sbox<int*>(large), 2);
+        assert(small[0] == 1 && large[0] == 2);
+        assert(box.munmap_identity(small, 4096) == 0);
+        assert(box.munmap_identity(large, 1 << 20) == 0);
+    }
+    PASS();
+
+    TEST("fds are sent in batches and translated both ways");
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+
+        // More than fit in one message, with a repeat and a negative fd
+        std::vector<int> fds;
+        for (int i = 0; i < 160; i++) {
+            int p[2];
+            assert(pipe(p) == 0);
+            fds.push_back(p[0]);
+            fds.push_back(p[1]);
+        }
+        fds.push_back(fds[7]);
+        fds.push_back(-1);
+
+        std::vector<int> sandbox_fds(fds.size());
+        assert(box.register_fds(fds.data(), fds.size(), sandbox_fds.data()));
+        for (size_t i = 0; i + 1 < fds.size(); i++)
+            assert(fd_target(box.pid(), sandbox_fds[i]) ==
+                   fd_target(getpid(), fds[i]));
+        assert(sandbox_fds[fds.size() - 2] == sandbox_fds[7]);
+        assert(sandbox_fds.back() == -1);
+
+        // Sent fds are cached, and closing one drops it from the cache
+        assert(box.register_fd(fds[100]) == sandbox_fds[100]);
+        assert(box.close_fd(sandbox_fds[100]) == 0);
+        int again = box.register_fd(fds[100]);
+        assert(again >= 0);
+        assert(fd_target(box.pid(), again) == fd_target(getpid(), fds[100]));
+
+        // Closed behind the cache's back, the number is reused for the next
+        // fd received, which must not be taken for the old one
+        assert(box.call<int(int)>("close", again) == 0);
+        int fresh[2];
+        assert(pipe(fresh) == 0);
+        assert(box.register_fd(fresh[0]) == again);
+        int resent = box.register_fd(fds[100]);
+        assert(resent != again);
+        assert(fd_target(box.pid(), resent) == fd_target(getpid(), fds[100]));
+
+        close(fresh[0]);
+        close(fresh[1]);
+        for (size_t i = 0; i + 2 < fds.size(); i++)
+            close(fds[i]);
+    }
+    PASS();
+
+    TEST("death wakes threads blocked on worker channels");
+    {
+        int before = count_tasks(getpid());
+        std::vector<std::unique_ptr<sbox::Sandbox<sbox::Process>>> boxes;
+        for (int i = 0; i < 8; i++)
+            boxes.push_back(
+                std::make_unique<sbox::Sandbox<sbox::Process>>(
+                    "./test_sandbox"));
+        // One reaper thread watches them all
+        assert(count_tasks(getpid()) <= before + 1);
+
+        auto& box = *boxes[3];
+        victim_pid = box.pid();
+        auto cb = box.register_callback(kill_caller_callback);
+        auto add = box.fn<int(int, int)>("add");
+        std::thread t([&] {
+            assert(add(1, 2) == 3);
+            box.call<int(int (*)(int, int), int, int)>("apply_binary_callback",
+                                                        cb, 1, 2);
+            // And they stay woken
+            assert(add(1, 2) == 0);
+        });
+        t.join();
+        assert(!box.alive());
+        for (size_t i = 0; i < boxes.size(); i++) {
+            if (i != 3)
+                assert(boxes[i]->call<int(int, int)>("add", 2, 2) == 4);
+        }
+    }
+    PASS();
+
+    TEST("worker placement and scheduling policy");
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        std::thread t([&] {
+            assert(box.call<int(int, int)>("add", 1, 2) == 3);
+            assert(box.pin_worker());
+            assert(box.pin_worker(0));
+            assert(box.pin_worker(PBOX_CPU_ANY));
+            assert(!box.pin_worker(-5));
+
+            assert(box.set_worker_sched(SCHED_BATCH));
+            assert(count_tasks_with_policy(box.pid(), SCHED_BATCH) == 1);
+            // Realtime policies stay out of the sandbox's reach
+            assert(!box.set_worker_sched(SCHED_FIFO, 1));
+            assert(box.set_worker_sched(SCHED_OTHER));
+            assert(count_tasks_with_policy(box.pid(), SCHED_BATCH) == 0);
+            assert(box.call<int(int, int)>("add", 2, 3) == 5);
+        });
+        t.join();
+    }
+    PASS();
+
+    TEST("busy-poll mode switches on and off at runtime");
+    {
+        sbox::Sandbox<sbox::Process> box("./test_sandbox");
+        PBoxWaitPolicy before = box.wait_policy();
+        assert(box.set_busy_poll(1000000, {0}));
+        assert(box.wait_policy().spin_max_ns == 1000000);
+        assert(box.wait_policy().adaptive == 0);
+        assert(!box.set_busy_poll(1000000, {-1}));
+
+        // Unchanged call sites, on existing and new channels
+        assert(box.call<int(int, int)>("add", 1, 2) == 3);
+        std::thread t([&] {
+            for (int i = 0; i < 100; i++)
+                assert(box.call<int(int, int)>("add", i, 1) == i + 1);
+        });
+        t.join();
+
+        // The worker moves to CPU 0 before waiting for its next request,
+        // so it is there by the time the second call is served
+        assert(box.call<int(int, int)>("add", 2, 2) == 4);
+        assert(box.call<int(int, int)>("add", 2, 2) == 4);
+        assert(count_tasks_with_status(box.pid(), "Cpus_allowed_list", "0") >=
+               1);
+
+        // Past the idle period every sandbox thread sleeps again
+        int running = -1;
+        for (int i = 0; i < 100 && running != 0; i++) {
+            usleep(20000);
+            running =
+                count_tasks_with_status(box.pid(), "State", "R (running)");
+        }
+        assert(running == 0);
+
+        assert(box.set_busy_poll(0));
+        assert(box.wait_policy().spin_max_ns == before.spin_max_ns);
+        assert(box.wait_policy().adaptive == before.adaptive);
+        assert(box.call<int(int, int)>("add", 3, 3) == 6);
+
+        // An explicit policy ends busy-poll's, and ending busy-poll then
+        // leaves it alone
+        assert(box.set_busy_poll(1000000));
+        box.set_wait_policy({7000, 0});
+        assert(box.set_busy_poll(0));
+        assert(box.wait_policy().spin_max_ns == 7000);
+        assert(box.wait_policy().adaptive == 0);
+        assert(box.call<int(int, int)>("add", 4, 4) == 8);
+    }
+    PASS();
+
     TEST_SUMMARY();
 }
@@ -134,6 +134,19 @@ double apply_double_callback(double_callback_t cb, double val) {
     return cb(val);
 }
 
+// Reports records 0..n-1 through cb, one call per record
+void emit_records(callback_t cb, int n) {
+    for (int i = 0; i < n; i++) {
+        cb(i);
+    }
+}
+
+// Reports record a, then asks cb to combine a and b
+int emit_then_apply(callback_t record, binary_callback_t cb, int a, int b) {
+    record(a);
+    return cb(a, b);
+}
+
 // -- Many parameters (up to 10 = PBOX_MAX_ARGS) --
 
 int sum8(int a, int b, int c, int d, int e, int f, int g, int h) {